@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FW_IMPLEMENTATION
+#include "fw.h"
+
+// max events in flight, keeps the kernel queue (max_queued_events) from overflowing
+#define BENCH_WINDOW 4096
+
+typedef struct{
+  const char* name;
+  FW_Flags flags;
+  int dirs; // number of directories the files are spread over
+} Bench_Mode;
+
+// the file operation repeated by the producer
+typedef struct{
+  const char* name;
+  FW_Event event;
+} Bench_Churn;
+
+typedef struct{
+  const Bench_Mode* mode;
+  const Bench_Churn* churn;
+  const char* root;
+  long count;
+  _Atomic uint64_t* sent; // monotonic send time per file
+  atomic_long received;
+} Bench;
+
+static uint64_t bench_now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_dir_path(Bench* bench, int dir, char* buf, size_t size){
+  if(bench->mode->dirs == 1){
+    snprintf(buf, size, "%s", bench->root);
+  }else{
+    snprintf(buf, size, "%s/d%d/d%d", bench->root, dir/32, dir%32);
+  }
+}
+
+static void bench_file_path(Bench* bench, long i, const char* prefix, char* buf, size_t size){
+  char dir[FW_PATH_MAX];
+  bench_dir_path(bench, i % bench->mode->dirs, dir, sizeof(dir));
+  snprintf(buf, size, "%s/%s%ld", dir, prefix, i);
+}
+
+static bool bench_setup(Bench* bench){
+  char path[FW_PATH_MAX+32];
+  if(mkdir(bench->root, 0755) < 0 && errno != EEXIST) return false;
+  for(int i = 0; bench->mode->dirs > 1 && i < bench->mode->dirs; ++i){
+    if(i%32 == 0){
+      snprintf(path, sizeof(path), "%s/d%d", bench->root, i/32);
+      if(mkdir(path, 0755) < 0) return false;
+    }
+    bench_dir_path(bench, i, path, sizeof(path));
+    if(mkdir(path, 0755) < 0) return false;
+  }
+  // everything but creation works on files that exist before the watch
+  if(bench->churn->event == FW_CREATE) return true;
+  for(long i = 0; i < bench->count; ++i){
+    bench_file_path(bench, i, "f", path, sizeof(path));
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if(fd < 0) return false;
+    close(fd);
+  }
+  return true;
+}
+
+static void bench_cleanup(const char* root){
+  char cmd[FW_PATH_MAX+16];
+  snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+  if(system(cmd) != 0){
+    fprintf(stderr, "failed to remove %s\n", root);
+  }
+}
+
+static void* bench_produce(void* arg){
+  Bench* bench = arg;
+  char path[FW_PATH_MAX+32];
+  char new_path[FW_PATH_MAX+32];
+  for(long i = 0; i < bench->count; ++i){
+    while(i - atomic_load_explicit(&bench->received, memory_order_acquire) >= BENCH_WINDOW){
+      sched_yield();
+    }
+    bench_file_path(bench, i, "f", path, sizeof(path));
+    atomic_store_explicit(&bench->sent[i], bench_now(), memory_order_relaxed);
+    bool ok = true;
+    switch(bench->churn->event){
+      case FW_CREATE:
+      case FW_MODIFY: {
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        ok = fd >= 0;
+        if(ok && bench->churn->event == FW_MODIFY) ok = write(fd, "x", 1) == 1;
+        if(fd >= 0) close(fd);
+      } break;
+      case FW_DELETE:
+        ok = unlink(path) == 0;
+        break;
+      case FW_RENAME:
+        bench_file_path(bench, i, "g", new_path, sizeof(new_path));
+        ok = rename(path, new_path) == 0;
+        break;
+      default: break;
+    }
+    if(!ok){
+      perror(bench->churn->name);
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+static int bench_compare(const void* a, const void* b){
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static double bench_percentile(uint64_t* sorted, long count, double p){
+  long i = (long)(p*(count-1));
+  return sorted[i]/1000.0;
+}
+
+static bool bench_run(const Bench_Mode* mode, const Bench_Churn* churn, const char* root, long count){
+  Bench bench = {
+    .mode = mode,
+    .churn = churn,
+    .root = root,
+    .count = count,
+  };
+  bench.sent = calloc(count, sizeof(*bench.sent));
+  uint64_t* latency = calloc(count, sizeof(*latency));
+  if(bench.sent == NULL || latency == NULL){
+    fprintf(stderr, "out of memory\n");
+    return false;
+  }
+
+  bench_cleanup(root);
+  if(!bench_setup(&bench)){
+    perror("setup");
+    return false;
+  }
+
+  FW fw;
+  FW_Options options = {.flags = mode->flags};
+  if(!fw_init_ex(&fw, root, churn->event, &options)){
+    printf("init failed %s\n", fw_strerror(fw_error(&fw)));
+    return false;
+  }
+  FW_MemoryUsage memory = fw_memory_usage(&fw);
+  // the setup walk is not part of the churn
+  uint64_t setup_syscalls = fw_stats(&fw).syscalls;
+
+  pthread_t producer;
+  uint64_t start = bench_now();
+  pthread_create(&producer, NULL, bench_produce, &bench);
+
+  long received = 0;
+  while(received < count){
+    if(!fw_watch(&fw)){
+      printf("watch failed %s\n", fw_strerror(fw_error(&fw)));
+      return false;
+    }
+    const char* name = fw_name(&fw);
+    if(name[0] != 'f') continue;
+    long i = atol(name+1);
+    latency[received++] = bench_now() - atomic_load_explicit(&bench.sent[i], memory_order_relaxed);
+    atomic_store_explicit(&bench.received, received, memory_order_release);
+  }
+  uint64_t elapsed = bench_now() - start;
+  FW_Stats stats = fw_stats(&fw);
+  pthread_join(producer, NULL);
+  fw_deinit(&fw);
+  bench_cleanup(root);
+
+  qsort(latency, count, sizeof(*latency), bench_compare);
+  printf("%-10s %-7s %8d %12.0f %9.1f %9.1f %9.1f %10.3f %10zu\n",
+      mode->name,
+      churn->name,
+      memory.watches > 0 ? (int)memory.watches : 1,
+      count/(elapsed/1e9),
+      bench_percentile(latency, count, 0.50),
+      bench_percentile(latency, count, 0.99),
+      bench_percentile(latency, count, 0.999),
+      (double)(stats.syscalls - setup_syscalls)/count,
+      memory.bytes_per_watch);
+
+  free(bench.sent);
+  free(latency);
+  return true;
+}
+
+int main(int argc, char** argv){
+  const char* program = *argv;
+  argv++;
+  argc--;
+
+  // tmpfs keeps the filesystem itself out of the measurement
+  const char* root = "/dev/shm/fw_bench";
+  long count = 100000;
+  if(argc > 0){
+    root = *argv;
+    argv++;
+    argc--;
+  }
+  if(argc > 0){
+    count = atol(*argv);
+  }
+  if(count <= 0){
+    printf("usage: %s [dir] [events]\n", program);
+    return 1;
+  }
+
+  const Bench_Mode modes[] = {
+    {.name = "single", .flags = 0, .dirs = 1},
+    {.name = "recursive", .flags = FW_RECURSIVE, .dirs = 1024},
+  };
+  const Bench_Churn churns[] = {
+    {.name = "create", .event = FW_CREATE},
+    {.name = "modify", .event = FW_MODIFY},
+    {.name = "delete", .event = FW_DELETE},
+    {.name = "rename", .event = FW_RENAME},
+  };
+
+  printf("%ld events per mode in %s\n", count, root);
+  printf("%-10s %-7s %8s %12s %9s %9s %9s %10s %10s\n",
+      "mode", "churn", "watches", "events/s", "p50(us)", "p99(us)", "p999(us)", "sys/ev", "B/watch");
+  for(size_t i = 0; i < sizeof(modes)/sizeof(*modes); ++i){
+    for(size_t j = 0; j < sizeof(churns)/sizeof(*churns); ++j){
+      if(!bench_run(&modes[i], &churns[j], root, count)) return 1;
+    }
+  }
+  return 0;
+}
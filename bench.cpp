@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// replays a prepared inotify buffer instead of reading the kernel queue
+// so only the parse and filter loop is measured
+static ssize_t bench_read(int fd, void* buf, size_t size);
+#define FW_READ bench_read
+
+#define FW_IMPLEMENTATION
+#include "fw.hpp"
+
+static constexpr char suffix_c[] = ".c";
+static constexpr char glob_c[] = "file*.c";
+
+struct Replay{
+  std::vector<char> buffer; // one read worth of events
+  long reads;
+};
+
+static Replay replay;
+
+static ssize_t bench_read(int fd, void* buf, size_t size){
+  if(replay.reads <= 0) return read(fd, buf, size);
+  replay.reads--;
+  size_t n = replay.buffer.size() < size ? replay.buffer.size() : size;
+  memcpy(buf, replay.buffer.data(), n);
+  return (ssize_t)n;
+}
+
+// fills one read with creates and modifies of .c and .o files
+static size_t bench_prepare(int wd, size_t size){
+  replay.buffer.clear();
+  char name[32];
+  for(int i = 0; ; ++i){
+    snprintf(name, sizeof(name), "file%d.%c", i, "cocooc"[i%6]);
+    size_t len = (strlen(name) + 1 + 15) & ~(size_t)15;
+    if(replay.buffer.size() + sizeof(struct inotify_event) + len > size) break;
+    struct inotify_event ev = {};
+    ev.wd = wd;
+    ev.mask = i%3 == 2 ? IN_MODIFY : IN_CREATE;
+    ev.len = (uint32_t)len;
+    size_t at = replay.buffer.size();
+    replay.buffer.resize(at + sizeof(ev) + len);
+    memcpy(&replay.buffer[at], &ev, sizeof(ev));
+    memcpy(&replay.buffer[at + sizeof(ev)], name, strlen(name) + 1);
+  }
+  size_t events = 0;
+  for(size_t at = 0; at < replay.buffer.size(); events++){
+    const struct inotify_event* ev = (const struct inotify_event*)&replay.buffer[at];
+    at += sizeof(*ev) + ev->len;
+  }
+  return events;
+}
+
+template<class Watcher, class Consume>
+static void bench_run(const char* name, Watcher& watcher, long reads, Consume consume){
+  size_t per_read = bench_prepare(watcher.get()->wd, sizeof(watcher.get()->event_buffer));
+  replay.reads = reads;
+  long matched = 0;
+  auto start = std::chrono::steady_clock::now();
+  while(replay.reads > 0){
+    for(auto& ev : watcher.poll()){
+      matched += consume(ev);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  long events = reads*(long)per_read;
+  printf("%-10s %12ld %10ld %10.2f %12.0f\n",
+      name, events, matched, elapsed.count()/events, events/(elapsed.count()/1e9));
+}
+
+int main(int argc, char** argv){
+  const char* root = "/dev/shm/fw_bench_cpp";
+  long reads = 200000;
+  if(argc > 1) root = argv[1];
+  if(argc > 2) reads = atol(argv[2]);
+  if(reads <= 0){
+    printf("usage: %s [dir] [reads]\n", argv[0]);
+    return 1;
+  }
+  if(mkdir(root, 0755) < 0 && errno != EEXIST){
+    perror("mkdir");
+    return 1;
+  }
+
+  try{
+    // the generic path gets its mask and suffix at runtime
+    FW_Event mask = FW_CREATE;
+    std::string suffix = argc > 3 ? argv[3] : suffix_c;
+
+    printf("%ld reads per mode\n", reads);
+    printf("%-10s %12s %10s %10s %12s\n", "mode", "events", "matched", "ns/event", "events/s");
+
+    fw::Watcher<> generic(root, mask);
+    bench_run("generic", generic, reads, [&](const fw::Event& ev){
+      std::string_view name = ev.name;
+      // the mask is applied by fw_next like for the other watchers
+      return name.size() >= suffix.size()
+        && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    });
+
+    fw::Watcher<FW_CREATE, fw::Suffix<suffix_c>> suffixed(root);
+    bench_run("suffix", suffixed, reads, [](const fw::Event&){ return true; });
+
+    fw::Watcher<FW_CREATE, fw::Glob<glob_c>> globbed(root);
+    bench_run("glob", globbed, reads, [](const fw::Event&){ return true; });
+  }catch(const fw::Error& e){
+    printf("watch failed %s\n", e.what());
+    return 1;
+  }
+
+  rmdir(root);
+  return 0;
+}
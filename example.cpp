@@ -0,0 +1,37 @@
+#include <cstdio>
+
+#define FW_IMPLEMENTATION
+#include "fw.hpp"
+
+int main(int argc, char** argv){
+  const char* watch_path = ".";
+  if(argc > 1){
+    watch_path = argv[1];
+  }
+
+  try{
+    FW_Options options = {};
+    options.flags = FW_RECURSIVE;
+    fw::Watcher watcher(watch_path, FW_ALL, &options);
+
+    while(true){
+      for(auto& ev : watcher.poll()){
+        std::string path = watcher.path(ev);
+        if(ev.type & FW_CREATE){
+          printf("created: %s\n", path.c_str());
+        }else if(ev.type & FW_MODIFY){
+          printf("modified: %s\n", path.c_str());
+        }else if(ev.type & FW_DELETE){
+          printf("deleted: %s\n", path.c_str());
+        }else if(ev.type & FW_RENAME){
+          printf("rename: %s -> %s\n", path.c_str(), watcher.new_path(ev).c_str());
+        }
+      }
+    }
+  }catch(const fw::Error& e){
+    printf("watch failed %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
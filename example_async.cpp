@@ -0,0 +1,44 @@
+#include <cstdio>
+
+#define FW_IMPLEMENTATION
+#include "fw.hpp"
+
+// one task per watched path on a single thread, built with ./nob async
+fw::Task watch(fw::Executor& executor, const char* path){
+  FW_Options options = {};
+  options.flags = FW_RECURSIVE;
+  fw::AsyncWatcher watcher(executor, path, FW_ALL | FW_DELETE_TREE, &options);
+  while(true){
+    for(auto& ev : co_await watcher.next()){
+      std::string event_path = watcher.path(ev);
+      if(ev.type & FW_CREATE){
+        printf("created: %s\n", event_path.c_str());
+      }else if(ev.type & FW_MODIFY){
+        printf("modified: %s\n", event_path.c_str());
+      }else if(ev.type & FW_DELETE_TREE){
+        printf("deleted tree: %s\n", event_path.c_str());
+      }else if(ev.type & FW_DELETE){
+        printf("deleted: %s\n", event_path.c_str());
+      }else if(ev.type & FW_RENAME){
+        printf("rename: %s -> %s\n", event_path.c_str(), watcher.new_path(ev).c_str());
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv){
+  try{
+    fw::Executor executor;
+    if(argc > 1){
+      for(int i = 1; i < argc; ++i) executor.spawn(watch(executor, argv[i]));
+    }else{
+      executor.spawn(watch(executor, "."));
+    }
+    executor.run();
+  }catch(const fw::Error& e){
+    printf("watch failed %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -24,8 +24,21 @@
 
 #ifndef FW_H_
 #define FW_H_
+// fstatat, dirfd, st_mtim and DT_DIR need POSIX 2008 and the BSD extensions,
+// which a strict -std=c11 build hides; include fw.h before other headers
+#if defined(__linux) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef FW_REALLOC
+#include <stdlib.h>
+#define FW_REALLOC realloc
+#define FW_FREE free
+#endif
 
 #if defined(__linux)
 #include <sys/inotify.h>
@@ -33,16 +46,35 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/mman.h>
 #define FW_NAME_MAX NAME_MAX
+#define FW_PATH_MAX PATH_MAX
+#ifndef FW_READ
+#define FW_READ read
+#endif
 #elif defined(__WIN32)
 #include <windows.h>
 #include <fileapi.h>
 #include <shlwapi.h>
+#include <stdio.h>
 #define FW_NAME_MAX MAX_PATH 
+#define FW_PATH_MAX MAX_PATH
 #else
 #error "Platform not supported"
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum{
   FW_CREATE = (1<<0),
   FW_DELETE = (1<<1),
@@ -52,6 +84,13 @@ typedef enum{
     | FW_DELETE
     | FW_MODIFY
     | FW_RENAME,
+  // a directory was deleted with everything in it, only received when
+  // passed to fw_init explicitly since it replaces those deletions
+  FW_DELETE_TREE = (1<<4),
+  // the watched path was deleted, moved away or unmounted and is watched
+  // again, only received when passed to fw_init explicitly
+  FW_ROOT_LOST = (1<<5),
+  FW_ROOT_BACK = (1<<6),
 } FW_Event;
 
 typedef enum{
@@ -65,389 +104,4339 @@ typedef enum{
   FW_E_NO_EVENT,
   FW_E_INCOMPLETE_EVENT,
   FW_E_IO_ERROR,
+  FW_E_MEMORY_BUDGET,
 } FW_Error;
 
+typedef enum{
+  FW_RECURSIVE = (1<<0),
+  FW_LATENCY = (1<<1),
+  FW_NONBLOCK = (1<<2),
+  FW_COARSE_TIME = (1<<3),
+  FW_LAZY = (1<<4),
+  FW_REARM = (1<<5),
+  // passed on to inotify (IN_EXCL_UNLINK, IN_ONLYDIR, IN_DONT_FOLLOW and
+  // IN_MASK_ADD), ignored on Windows
+  FW_EXCL_UNLINK = (1<<6),
+  FW_ONLYDIR = (1<<7),
+  FW_DONT_FOLLOW = (1<<8),
+  // only when adding watches, fw_set_events replaces, IN_ACCESS, IN_OPEN and
+  // IN_CLOSE_NOWRITE are never delivered for watches added to fw_fd
+  FW_MASK_ADD = (1<<9),
+} FW_Flags;
+
+typedef struct{
+  FW_Flags flags;
+  size_t memory_budget; // max bytes used for the watch table, 0 is unlimited
+  // FW_RECURSIVE only, directories beyond the watch limit are polled
+  size_t watch_limit; // max kernel watches, 0 uses max_user_watches
+  int poll_interval; // milliseconds between polls, 0 is 2000
+  const char* const* pinned; // directories (relative to path) that are always watched
+  size_t pinned_count;
+  const char* inventory; // file caching the directory tree, see fw_inventory_save
+  // directories (relative to path) whose events overtake all others
+  const char* const* priority;
+  size_t priority_count;
+  // names an event has to pass to be delivered, a rename passes if either
+  // name does, the others count as filtered in fw_stats
+  bool (*filter)(const char* name, size_t len, void* data);
+  void* filter_data;
+} FW_Options;
+
+// an event of the current batch, the names point into the read buffer and
+// stay valid until the batch is exhausted and the next fw_read reads a new one
+typedef struct{
+  FW_Event event;
+  const char* name;
+  const char* new_name; // only set for FW_RENAME
+  size_t name_len;
+  size_t new_name_len;
+  int dir; // directory of name, used to build its path
+  int new_dir;
+  uint64_t time; // monotonic nanoseconds at which the batch was read
+} FW_Record;
+
+typedef struct{
+  size_t bytes; // bytes allocated for the watch table
+  size_t watches;
+  size_t bytes_per_watch;
+} FW_MemoryUsage;
+
+typedef struct{
+  size_t directories;
+  size_t watched; // by a kernel watch
+  size_t polled; // by comparing stat snapshots
+  size_t watch_limit; // 0 when unlimited
+  size_t pending; // directories whose subdirectories are not registered yet
+} FW_Coverage;
+
+// log-linear buckets (16 per power of two) of nanosecond values
+#define FW_HISTOGRAM_SUB_BITS 4
+#define FW_HISTOGRAM_BUCKETS ((64 - FW_HISTOGRAM_SUB_BITS + 1) << FW_HISTOGRAM_SUB_BITS)
+
+typedef struct{
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[FW_HISTOGRAM_BUCKETS];
+} FW_Histogram;
+
+typedef struct{
+  FW_Histogram kernel_to_read; // upper bound, only for batches that were already queued
+  FW_Histogram read_to_parse;
+  FW_Histogram parse_to_delivery;
+} FW_Latency;
+
+// cumulative counters, safe to read from other threads through fw_stats
+typedef struct{
+  uint64_t reads; // read syscalls
+  uint64_t syscalls; // every syscall of the watcher, reads, watches, stats, listings and polls
+  uint64_t bytes_read;
+  uint64_t events_parsed;
+  uint64_t events_filtered; // parsed but not delivered
+  uint64_t events_delivered;
+  uint64_t overflows; // kernel queue overflows, events were lost
+  uint64_t incomplete_renames;
+  uint64_t buffer_high_water; // most bytes returned by a single read
+  uint64_t watches;
+  uint64_t polls; // passes over the directories without a kernel watch
+  uint64_t promotions; // polled directories that got a kernel watch
+  uint64_t demotions; // watched directories that went back to polling
+  uint64_t inventory_hits; // directories registered from the inventory without being read
+  uint64_t directory_moves; // renamed directories moved in the watch tree
+  uint64_t deletes_collapsed; // deletions replaced by FW_DELETE_TREE
+  uint64_t events_prioritized; // events that overtook others in a priority directory
+} FW_Stats;
+
+#if defined(__linux)
+#define FW__POLL_INTERVAL 2000 // ms
+#define FW__POLL_PROMOTIONS 16 // per pass
+#define FW__WALK_STEP 64 // directories registered per fw_read with FW_LAZY
+#define FW__HOLD_TIME 20 // ms without events before held deletions are delivered
+#define FW__HOLD_MAX (4 << 20) // bytes of held deletions
+// private inotify mask bits, never subscribed to by fw itself, watches the
+// caller adds to fw_fd may still get them so they are cleared on every read
+#define FW__IN_RELEASED IN_CLOSE_NOWRITE // held before, must not be held again
+#define FW__IN_TREE IN_OPEN // a directory deleted with its contents
+#define FW__IN_ROOT IN_ACCESS // the watched path is back, or gone with IN_IGNORED
+#define FW__IN_PRIVATE (FW__IN_RELEASED | FW__IN_TREE | FW__IN_ROOT)
+
+// a directory with deletions in the held run, its deletions are chained
+// through the otherwise unused cookie of their held events
+typedef struct{
+  int wd; // -1 for a free slot
+  uint32_t last; // offset+1 of its last held deletion, 0 for none
+  uint32_t absorbed; // deletions dropped since it was removed itself
+  bool removed;
+} FW__HeldDir;
+
+// a watched directory, linked to its parent so full paths
+// can be rebuilt on demand without storing them per watch
+typedef struct{
+  int wd; // -1 when unused, below -1 for polled directories
+  int parent; // index of the parent watch, -1 for the root (or next free slot when unused)
+  uint32_t name; // offset in the name pool, the root is named by its path
+  uint32_t active; // seconds after init of the last event, UINT32_MAX when pinned
+  // the subdirectories, so a subtree is dropped without scanning all watches
+  int child; // first subdirectory, -1 for none
+  int next; // siblings, -1 at either end
+  int prev;
+} FW__Watch;
+
+// an entry of a polled directory as seen by the last poll
+typedef struct{
+  uint64_t hash; // of the name, entries are sorted by it
+  uint64_t mtime;
+  uint64_t size;
+  uint32_t name;
+  uint32_t dir;
+} FW__PollEntry;
+
+// a directory without a kernel watch, its watch has wd -2-slot
+typedef struct{
+  int index; // watch of the directory, -1 when unused
+  int next_free;
+  FW__PollEntry* entries;
+  size_t entry_count;
+  size_t entry_capacity;
+} FW__Poll;
+
+// a directory whose subdirectories still have to be registered
+typedef struct{
+  uint64_t mtime; // newer directories first within the same depth
+  int index; // -1 when its watch was removed in the meantime
+  uint32_t depth;
+  int record; // in the loaded inventory, -1 when it has none
+} FW__Walk;
+
+// identity of a directory when its entries were read, 0 when unknown,
+// ctime since it changes with the mtime but cannot be set back by users
+typedef struct{
+  uint64_t inode;
+  uint64_t ctime;
+} FW__Stamp;
+
+// the inventory file is a header, the root path (padded to 8 bytes), the
+// records in breadth first order (so the children of a directory are
+// contiguous) and their names, all in host byte order
+typedef struct{
+  char magic[4]; // FWI1
+  uint32_t version;
+  uint64_t record_count;
+  uint64_t names_size;
+  uint64_t root_len;
+} FW__InventoryHeader;
+
+typedef struct{
+  uint64_t inode;
+  uint64_t ctime;
+  uint32_t name; // offset in the names
+  uint32_t name_len;
+  uint32_t first_child;
+  uint32_t child_count;
+} FW__InventoryRecord;
+
+// header of an interned name in the name pool, directories with
+// the same name ("src", ".git", ...) share a single entry
+typedef struct{
+  uint32_t refs;
+  uint16_t len;
+} FW__Name;
+
+// events of one read in a lane or batch, up to the offset end
+typedef struct{
+  size_t end;
+  uint64_t time;
+  uint64_t read_time;
+} FW__Run;
+
+// inotify events drained from the kernel and waiting for fw_read, with
+// the time of the read that got them
+typedef struct{
+  char* data;
+  size_t size;
+  size_t offset;
+  size_t capacity;
+  FW__Run* runs;
+  size_t run_count;
+  size_t run_first; // the run of the event at offset
+  size_t run_capacity;
+} FW__Lane;
+#endif
+
 typedef struct{
   FW_Error error;
   FW_Event watch_events;
   FW_Event received_events;
+  FW_Flags flags;
+  size_t memory_budget;
+  bool (*filter)(const char* name, size_t len, void* data);
+  void* filter_data;
   char name[FW_NAME_MAX+1];
   char new_name[FW_NAME_MAX+1];
   
   char event_buffer[1024];
 
+  FW_Stats stats;
+
+  // taken once per read and shared by all events of the batch
+  uint64_t batch_time;
+  uint64_t event_time;
+
+  // only allocated with FW_LATENCY
+  FW_Latency* latency;
+  uint64_t read_time;
+  uint64_t parse_time;
+  uint64_t return_time;
+
 #if defined(__linux)
   int fd;
   int wd;
-  int bytes_left;
-  struct inotify_event* event;
+  // unread part of event_buffer
+  int event_offset;
+  int event_size;
+
+  // watch tree, indexed by wd through an open addressing map
+  FW__Watch* watches;
+  int watch_count;
+  size_t watch_capacity;
+  int watch_free;
+  int* watch_map;
+  size_t watch_map_capacity;
+  // children by parent index and interned name, the second half of the
+  // watch_map allocation
+  int* child_map;
+
+  // interned directory names, indexed by an open addressing map
+  char* names;
+  size_t names_size;
+  size_t names_capacity;
+  size_t names_dead;
+  uint32_t* name_map;
+  size_t name_map_count;
+  size_t name_map_capacity;
+
+  // wd of the directories containing name and new_name
+  int event_wd;
+  int new_event_wd;
+
+  // directories polled once the watch limit is reached, their changes
+  // are queued as inotify events and parsed like those of the kernel
+  size_t watch_limit;
+  int poll_interval;
+  uint64_t poll_deadline;
+  uint64_t active_base;
+  char* pinned; // NUL separated
+  size_t pinned_count;
+  FW__Poll* polls;
+  size_t poll_capacity;
+  int poll_count;
+  int poll_free;
+  size_t poll_entry_bytes;
+  FW__PollEntry* scan;
+  size_t scan_count;
+  size_t scan_capacity;
+  char* pending;
+  size_t pending_size;
+  size_t pending_offset;
+  size_t pending_capacity;
+
+  // watching a single file, the root watch is the file itself while its
+  // name is kept here and its directory is the root of the watch tree
+  char* file_name;
+  size_t file_name_len;
+  uint64_t file_inode;
+  uint64_t file_device;
+  int file_parent_wd; // watch on the directory while the file is missing, -1 otherwise
+
+  // the watched path is gone, with FW_REARM lost_wd watches the deepest
+  // directory on the way to it that still exists
+  bool lost;
+  int lost_wd;
+  size_t lost_len; // start of the next name in the path after lost_wd
+
+  // with priority directories the kernel queue is drained into a priority
+  // and a bulk lane, priority_index holds the watches of the directories
+  char* priority; // NUL separated
+  size_t priority_count;
+  int* priority_index;
+  FW__Lane lanes[2];
+  // the read times of a batch taken from the lanes
+  FW__Run* batch_runs;
+  size_t batch_run_count;
+  size_t batch_run;
+  size_t batch_run_capacity;
+  // lane of every watch, 0 while unknown, valid as long as lane_version
+  // matches tree_version which changes with every change of the tree
+  uint8_t* lane_cache;
+  size_t lane_cache_capacity;
+  uint64_t lane_version;
+  uint64_t tree_version;
+
+  // a run of deletions held back with FW_DELETE_TREE, as inotify events,
+  // the deletions in directories that were removed during the run are
+  // dropped (mask 0) as soon as their IN_IGNORED arrives
+  char* held;
+  size_t held_size;
+  size_t held_capacity;
+  size_t held_dropped; // bytes of dropped events not compacted yet
+  uint64_t hold_deadline;
+  FW__HeldDir* held_dirs; // open addressing by wd
+  size_t held_dir_count;
+  size_t held_dir_capacity;
+
+  // heap of directories left to walk, drained by fw_read with FW_LAZY
+  FW__Walk* walks;
+  size_t walk_count;
+  size_t walk_capacity;
+  int* walk_slots; // by watch, its position in walks or -1
+  size_t walk_slot_capacity;
+  bool walked; // the tree was walked once
+
+  // inventory loaded at init, freed once the walk is done, the stamps
+  // are only kept when it is saved again
+  char* inventory_path;
+  char* inventory;
+  size_t inventory_size;
+  FW__Stamp* stamps;
+  size_t stamp_capacity;
 
 #elif defined(__WIN32)
   HANDLE handle;
   FILE_NOTIFY_INFORMATION* event;
   OVERLAPPED event_info;
+  char* root;
 #endif
   
 } FW;
 
+// an event as seen by a broadcast subscriber, the paths point into the
+// ring and stay valid until the next fw_broadcast_next of that subscriber
+typedef struct{
+  FW_Event event;
+  uint64_t time;
+  const char* path;
+  const char* new_path; // only set for FW_RENAME
+  size_t path_len;
+  size_t new_path_len;
+} FW_BroadcastEvent;
+
+// a subscriber of a broadcast ring, padded to a cache line so
+// subscribers on different threads do not slow each other down
+typedef struct{
+  uint64_t cursor; // released up to here, read by the producer
+  uint64_t next; // start of the next event
+  char padding[48];
+} FW__Subscriber;
+
+// a single watcher feeding several consumers, every event is parsed and
+// its paths built once, then read by each subscriber at its own pace
+typedef struct{
+  FW_Error error;
+  char* buffer;
+  size_t capacity; // power of two
+  uint64_t head; // written by the producer but not yet published
+  char padding[40];
+  uint64_t published;
+  FW__Subscriber* subscribers;
+  int subscriber_count;
+} FW_Broadcast;
+
+// a journaled event, the paths are not NUL terminated
+typedef struct{
+  uint64_t offset; // sequence number of the event in the journal
+  FW_Event event;
+  uint64_t time;
+  const char* path;
+  const char* new_path; // only set for FW_RENAME
+  size_t path_len;
+  size_t new_path_len;
+} FW_JournalEvent;
+
+// upper bound of an encoded event with paths of at most FW_PATH_MAX
+#define FW_JOURNAL_MAX_EVENT (4*10 + 2*FW_PATH_MAX)
+
+#if defined(__linux)
+
+// appends events to segment files in a directory, every segment is
+// named after the offset of its first event
+typedef struct{
+  FW_Error error;
+  int dir;
+  int fd; // current segment, -1 until the first event
+  char* buffer; // encoded events not yet written
+  size_t buffer_size;
+  size_t segment_size;
+  size_t segment_limit;
+  uint64_t offset; // offset of the next event
+  uint64_t time; // time of the previous event, times are stored as deltas
+} FW_Journal;
+
+// replays a journal from a mapping of one segment at a time
+typedef struct{
+  FW_Error error;
+  int dir;
+  int fd;
+  const uint8_t* data;
+  size_t size;
+  size_t position;
+  uint64_t start; // events before this offset are skipped
+  uint64_t offset;
+  uint64_t time;
+} FW_Replay;
+
+// decides whether an event ends fw_wait_for, fw can be used to build its paths
+typedef bool (*FW_Predicate)(FW* fw, const FW_Record* record, void* user);
+
+typedef struct{
+  char* path; // NULL for a free slot
+  FW_Event events;
+  uint64_t used; // fw_wait_for call that used it last
+  FW fw;
+} FW__Waiter;
+
+// watchers kept armed between fw_wait_for calls, so changes in between are
+// delivered by the next call and only the first call on a path sets it up
+typedef struct{
+  FW_Error error;
+  FW__Waiter* waiters;
+  size_t waiter_count;
+  size_t capacity;
+  uint64_t calls;
+} FW_WaitPool;
+#endif
+
 // --- polling fucntions ---
 bool fw_init(FW* self, const char* path, FW_Event events);
+bool fw_init_ex(FW* self, const char* path, FW_Event events, const FW_Options* options);
 bool fw_watch(FW* self);
 void fw_deinit(FW* self);
 bool fw_once(FW* self, const char* path, FW_Event events);
+bool fw_set_events(FW* self, FW_Event events);
+
+// --- batch functions ---
+bool fw_read(FW* self);
+bool fw_next(FW* self, FW_Record* record);
+size_t fw_record_path(FW* self, const FW_Record* record, char* buf, size_t size);
+size_t fw_record_new_path(FW* self, const FW_Record* record, char* buf, size_t size);
+
+// --- broadcast ---
+bool fw_broadcast_init(FW_Broadcast* self, size_t capacity, int subscribers);
+void fw_broadcast_deinit(FW_Broadcast* self);
+bool fw_broadcast_pump(FW_Broadcast* self, FW* fw);
+bool fw_broadcast_next(FW_Broadcast* self, int subscriber, FW_BroadcastEvent* event);
+void fw_broadcast_close(FW_Broadcast* self, int subscriber);
+
+// --- journal ---
+size_t fw_journal_encode(uint8_t* buf, uint64_t* time, const FW_JournalEvent* event);
+bool fw_journal_decode(const uint8_t* data, size_t size, size_t* position, uint64_t* time, FW_JournalEvent* event);
+#if defined(__linux)
+bool fw_journal_open(FW_Journal* self, const char* path, size_t segment_limit);
+bool fw_journal_append(FW_Journal* self, FW* fw, const FW_Record* record);
+bool fw_journal_pump(FW_Journal* self, FW* fw);
+bool fw_journal_flush(FW_Journal* self);
+void fw_journal_close(FW_Journal* self);
+bool fw_replay_open(FW_Replay* self, const char* path, uint64_t offset);
+bool fw_replay_next(FW_Replay* self, FW_JournalEvent* event);
+void fw_replay_close(FW_Replay* self);
+bool fw_wait_pool_init(FW_WaitPool* self, size_t capacity);
+void fw_wait_pool_deinit(FW_WaitPool* self);
+FW* fw_wait_for(FW_WaitPool* self, const char* path, FW_Event events, FW_Predicate predicate, void* user, int timeout);
+#endif
 
 // --- event data getters ---
+int fw_fd(FW* self);
 FW_Event fw_event(FW* self);
+uint64_t fw_time(FW* self);
 const char* fw_name(FW* self);
 const char* fw_new_name(FW* self);
+FW_MemoryUsage fw_memory_usage(FW* self);
+FW_Coverage fw_coverage(FW* self);
+bool fw_ready(FW* self, const char* path);
+bool fw_inventory_save(FW* self, const char* path);
+int fw_timeout(FW* self);
+size_t fw_path(FW* self, char* buf, size_t size);
+size_t fw_new_path(FW* self, char* buf, size_t size);
+
+// --- instrumentation ---
+FW_Stats fw_stats(FW* self);
+const FW_Latency* fw_latency(FW* self);
+uint64_t fw_histogram_percentile(const FW_Histogram* histogram, double percentile);
 
 // --- error handling ---
 const char* fw_strerror(FW_Error error);
 FW_Error fw_error(FW* self);
 
 #ifdef FW_IMPLEMENTATION
-bool fw_init(FW* self, const char* path, FW_Event events){
-  memset(self, 0, sizeof(*self));
-  self->watch_events = events;
+// trace points on the fw_watch hot path, define FW_TRACE(point, ...) to hook
+// them or FW_USDT to turn them into USDT probes (provider "fw") that can be
+// attached to with bpftrace, perf or SystemTap, otherwise they compile away
+//   read(fd, bytes)           after every read
+//   parse(wd, mask, name)     for every event taken from the buffer
+//   consume(wd, bytes_left)   when an event is removed from the buffer
+//   rename_pair(name, new_name, incomplete)
+//   deliver(event, name)      when fw_watch returns an event
+#ifndef FW_TRACE
+#if defined(FW_USDT) && defined(__linux)
+#include <sys/sdt.h>
+#define FW_TRACE(point, ...) STAP_PROBEV(fw, point, __VA_ARGS__)
+#else
+#define FW_TRACE(...) ((void)0)
+#endif
+#endif
+
+// fw_watch is the only writer, so a relaxed load and store is enough
+// for other threads to see whole values and avoids a locked add
+#define FW__STAT_ADD(self, field, n) \
+  __atomic_store_n(&(self)->stats.field, __atomic_load_n(&(self)->stats.field, __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define FW__STAT_SET(self, field, value) \
+  __atomic_store_n(&(self)->stats.field, (value), __ATOMIC_RELAXED)
 
 #if defined(__linux)
+void fw__add_watch_error(FW* self){
+  switch(errno){
+    case EACCES: self->error = FW_E_ACCESS_DENIED; break;
+    case EEXIST: break; // ignore if file already watched (should not be possible anyway)
+    case EFAULT: self->error = FW_E_PATH_NOT_FOUND; break;
+    case ENAMETOOLONG: self->error = FW_E_PATH_TOO_LONG; break;
+    case ENOENT: self->error = FW_E_PATH_NOT_FOUND; break;
+    case EBADF:  self->error = FW_E_UNKNOWN; break;
+    case EINVAL: self->error = FW_E_INVALID_ARGUMENT; break;
+    case ENOMEM: self->error = FW_E_PLATFORM_LIMIT; break;
+    case EMFILE: self->error = FW_E_PLATFORM_LIMIT; break;
+    case ENOSPC: self->error = FW_E_PLATFORM_LIMIT; break;
+    case ENOTDIR: self->error = FW_E_INVALID_ARGUMENT; break;
+    default: self->error = FW_E_UNKNOWN; break;
+  }
+}
 
-  self->fd = inotify_init();
+int fw__add_watch(FW* self, const char* path, uint32_t mask){
+  FW__STAT_ADD(self, syscalls, 1);
+  return inotify_add_watch(self->fd, path, mask);
+}
 
-  if(self->fd < 0){
-    switch(errno){
-      case EINVAL: self->error = FW_E_INVALID_ARGUMENT; break;
-      case ENOMEM: self->error = FW_E_PLATFORM_LIMIT; break;
-      case EMFILE: self->error = FW_E_PLATFORM_LIMIT; break;
-      default: self->error = FW_E_UNKNOWN; break;
-    }
-    return false;
+void fw__rm_watch(FW* self, int wd){
+  FW__STAT_ADD(self, syscalls, 1);
+  inotify_rm_watch(self->fd, wd);
+}
+
+// kernel side flags of every new watch, IN_MASK_ADD only changes anything
+// for a directory the caller watches through fw_fd already
+uint32_t fw__inotify_flags(FW* self){
+  uint32_t in_flags = 0;
+  if(self->flags & FW_EXCL_UNLINK) in_flags |= IN_EXCL_UNLINK;
+  if(self->flags & FW_DONT_FOLLOW) in_flags |= IN_DONT_FOLLOW;
+  if(self->flags & FW_MASK_ADD) in_flags |= IN_MASK_ADD;
+  return in_flags;
+}
+
+uint32_t fw__inotify_mask(FW* self){
+  if(self->file_name != NULL){
+    // the file itself is replaced when an editor saves it, which is only
+    // seen as the link count of the old one dropping
+    uint32_t in_events = IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    if(self->watch_events & FW_MODIFY) in_events |= IN_MODIFY;
+    return in_events | fw__inotify_flags(self);
+  }
+  uint32_t in_events = fw__inotify_flags(self);
+  if(self->watch_events & FW_CREATE) in_events |= IN_CREATE;
+  if(self->watch_events & (FW_DELETE | FW_DELETE_TREE)) in_events |= IN_DELETE;
+  if(self->watch_events & FW_MODIFY) in_events |= IN_MODIFY;
+  if(self->watch_events & FW_RENAME) in_events |= IN_MOVE;
+  if(self->flags & FW_RECURSIVE){
+    // needed to follow directories entering and leaving the tree
+    in_events |= IN_CREATE | IN_MOVE;
   }
+  return in_events;
+}
 
-  int in_events = 0;
-  if(events & FW_CREATE) in_events |= IN_CREATE;
-  if(events & FW_DELETE) in_events |= IN_DELETE;
-  if(events & FW_MODIFY) in_events |= IN_MODIFY;
-  if(events & FW_RENAME) in_events |= IN_MOVE;
+size_t fw__memory_used(FW* self){
+  return self->watch_capacity*sizeof(*self->watches)
+    + self->watch_map_capacity*sizeof(*self->watch_map)*2
+    + self->names_capacity
+    + self->name_map_capacity*sizeof(*self->name_map)
+    + self->poll_capacity*sizeof(*self->polls)
+    + self->poll_entry_bytes
+    + self->scan_capacity*sizeof(*self->scan)
+    + self->pending_capacity
+    + self->held_capacity
+    + self->held_dir_capacity*sizeof(*self->held_dirs)
+    + self->lanes[0].capacity
+    + self->lanes[1].capacity
+    + (self->lanes[0].run_capacity + self->lanes[1].run_capacity + self->batch_run_capacity)*sizeof(FW__Run)
+    + self->lane_cache_capacity
+    + self->walk_capacity*sizeof(*self->walks)
+    + self->walk_slot_capacity*sizeof(*self->walk_slots)
+    + self->inventory_size
+    + self->stamp_capacity*sizeof(*self->stamps);
+}
 
-  self->wd = inotify_add_watch(self->fd, path, in_events);
-  if(self->wd < 0){
-    switch(errno){
-      case EACCES: self->error = FW_E_ACCESS_DENIED; break;
-      case EEXIST: break; // ignore if file already watched (should not be possible anyway)
-      case EFAULT: self->error = FW_E_PATH_NOT_FOUND; break;
-      case ENAMETOOLONG: self->error = FW_E_PATH_TOO_LONG; break;
-      case ENOENT: self->error = FW_E_PATH_NOT_FOUND; break;
-      case EBADF:  self->error = FW_E_UNKNOWN; break;
-      case EINVAL: self->error = FW_E_INVALID_ARGUMENT; break;
-      case ENOMEM: self->error = FW_E_PLATFORM_LIMIT; break;
-      case EMFILE: self->error = FW_E_PLATFORM_LIMIT; break;
-      case ENOSPC: self->error = FW_E_PLATFORM_LIMIT; break;
-      case ENOTDIR: self->error = FW_E_INVALID_ARGUMENT; break;
-      default: self->error = FW_E_UNKNOWN; break;
+// grows an array to at least needed items while staying within the memory budget
+bool fw__grow(FW* self, void** items, size_t* capacity, size_t item_size, size_t needed){
+  if(needed <= *capacity) return true;
+  size_t new_capacity = *capacity == 0 ? 16 : *capacity;
+  while(new_capacity < needed) new_capacity *= 2;
+
+  if(self->memory_budget > 0){
+    size_t used = fw__memory_used(self) - *capacity*item_size;
+    size_t available = self->memory_budget > used ? (self->memory_budget - used)/item_size : 0;
+    if(available < needed){
+      self->error = FW_E_MEMORY_BUDGET;
+      return false;
     }
+    if(new_capacity > available) new_capacity = available;
+  }
+
+  void* new_items = FW_REALLOC(*items, new_capacity*item_size);
+  if(new_items == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
     return false;
   }
+  *items = new_items;
+  *capacity = new_capacity;
   return true;
+}
 
-#elif defined(__WIN32)
+FW__Name* fw__name(FW* self, uint32_t name){
+  return (FW__Name*)(self->names + name);
+}
 
-  self->handle = CreateFile(strdup(path),
-      FILE_LIST_DIRECTORY,
-      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-      NULL,
-      OPEN_EXISTING,
-      FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
-      NULL);
+const char* fw__name_str(FW* self, uint32_t name){
+  return self->names + name + sizeof(FW__Name);
+}
 
-  if(self->handle == INVALID_HANDLE_VALUE){
-    self->error = FW_E_UNKNOWN;
-    return false;
-  }
+size_t fw__name_size(size_t len){
+  size_t size = sizeof(FW__Name) + len + 1;
+  return (size + sizeof(uint32_t)-1) & ~(size_t)(sizeof(uint32_t)-1);
+}
 
-  self->event_info.hEvent = CreateEvent(NULL, FALSE, 0, NULL);
-  if(self->event_info.hEvent == INVALID_HANDLE_VALUE){
-    self->error = FW_E_UNKNOWN;
-    return false;
+size_t fw__name_hash(FW* self, const char* str, size_t len){
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; ++i){
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
   }
+  return hash & (self->name_map_capacity-1);
+}
 
+bool fw__name_map_rebuild(FW* self, size_t capacity){
+  if(capacity > self->name_map_capacity){
+    if(!fw__grow(self, (void**)&self->name_map, &self->name_map_capacity, sizeof(*self->name_map), capacity)){
+      return false;
+    }
+  }
+  memset(self->name_map, 0, self->name_map_capacity*sizeof(*self->name_map));
+  self->name_map_count = 0;
+  for(size_t offset = 0; offset < self->names_size; offset += fw__name_size(fw__name(self, offset)->len)){
+    size_t i = fw__name_hash(self, fw__name_str(self, offset), fw__name(self, offset)->len);
+    while(self->name_map[i] != 0) i = (i+1) & (self->name_map_capacity-1);
+    self->name_map[i] = offset+1;
+    self->name_map_count++;
+  }
   return true;
-#endif
-};
-
-void fw_deinit(FW* self){
-#if defined(__linux)
-  inotify_rm_watch(self->fd, self->wd);
-  close(self->fd);
-#elif defined(__WIN32)
-  CloseHandle(self->handle);
-#endif
 }
 
-bool fw__event_queue_is_empty(FW* self){
-#if defined(__linux)
-  return self->bytes_left == 0;
-#elif defined(__WIN32)
-  return self->event == NULL;
-#endif
+size_t fw__child_hash(FW* self, int parent, uint32_t name){
+  uint32_t hash = (uint32_t)parent*2654435761u ^ (name + 0x9e3779b9u)*2246822519u;
+  return hash & (self->watch_map_capacity-1);
 }
 
-void fw__consume_event(FW* self, char* name_buf){
-#if defined(__linux)
-  self->event = (struct inotify_event*) self->event_buffer;
-  if(name_buf != NULL){
-    memcpy(name_buf, self->event->name, self->event->len);
+void fw__child_map_insert(FW* self, int index){
+  size_t i = fw__child_hash(self, self->watches[index].parent, self->watches[index].name);
+  while(self->child_map[i] >= 0){
+    i = (i+1) & (self->watch_map_capacity-1);
   }
-  int event_size = sizeof(*self->event)+self->event->len;
-  self->bytes_left -= event_size;
-  assert(self->bytes_left >= 0);
-  for(int i = 0; i < self->bytes_left; ++i){
-    self->event_buffer[i] = self->event_buffer[i+event_size];
+  self->child_map[i] = index;
+}
+
+// the keys hold name offsets, which move when the pool is compacted
+void fw__child_map_rebuild(FW* self){
+  if(self->watch_map_capacity == 0) return;
+  memset(self->child_map, 0xff, sizeof(*self->child_map)*self->watch_map_capacity);
+  for(size_t i = 0; i < self->watch_capacity; ++i){
+    if(self->watches[i].wd != -1) fw__child_map_insert(self, i);
   }
+}
 
-#elif defined(__WIN32)
-  if(name_buf != NULL){
-    // TODO: handle non ascii names
-    DWORD name_len = self->event->FileNameLength/sizeof(wchar_t);
-    for(DWORD i = 0; i < name_len; ++i){
-      name_buf[i] = self->event->FileName[i];
+// the names held by poll snapshots (and a scan in progress) either
+// follow their new offset or count their references again
+void fw__poll_names(FW* self, bool count){
+  for(size_t i = 0; i <= self->poll_capacity; ++i){
+    FW__PollEntry* entries = i < self->poll_capacity ? self->polls[i].entries : self->scan;
+    size_t entry_count = i < self->poll_capacity ? self->polls[i].entry_count : self->scan_count;
+    for(size_t j = 0; j < entry_count; ++j){
+      if(count){
+        fw__name(self, entries[j].name)->refs++;
+      }else{
+        entries[j].name = fw__name(self, entries[j].name)->refs;
+      }
     }
   }
+}
 
-  if(self->event->NextEntryOffset != 0){
-    self->event = (FILE_NOTIFY_INFORMATION*)(((char*)self->event) + self->event->NextEntryOffset);
-  }else{
-    self->event = NULL;
+// drops unreferenced names by sliding live names down, the refs
+// field temporarily holds the new offset so watches can follow
+void fw__name_compact(FW* self){
+  size_t end = 0;
+  for(size_t offset = 0; offset < self->names_size; offset += fw__name_size(fw__name(self, offset)->len)){
+    FW__Name* name = fw__name(self, offset);
+    if(name->refs > 0){
+      name->refs = end;
+      end += fw__name_size(name->len);
+    }else{
+      name->refs = UINT32_MAX;
+    }
   }
-#endif
+  for(size_t i = 0; i < self->watch_capacity; ++i){
+    if(self->watches[i].wd != -1){
+      self->watches[i].name = fw__name(self, self->watches[i].name)->refs;
+    }
+  }
+  fw__poll_names(self, false);
+  size_t offset = 0;
+  while(offset < self->names_size){
+    FW__Name* name = fw__name(self, offset);
+    size_t size = fw__name_size(name->len);
+    if(name->refs != UINT32_MAX){
+      size_t to = name->refs;
+      memmove(self->names + to, self->names + offset, size);
+      fw__name(self, to)->refs = 0;
+    }
+    offset += size;
+  }
+  self->names_size = end;
+  self->names_dead = 0;
+  for(size_t i = 0; i < self->watch_capacity; ++i){
+    if(self->watches[i].wd != -1){
+      fw__name(self, self->watches[i].name)->refs++;
+    }
+  }
+  fw__poll_names(self, true);
+  fw__name_map_rebuild(self, self->name_map_capacity);
+  fw__child_map_rebuild(self);
 }
 
-bool fw_watch(FW* self){
-  if(self->watch_events == 0){
-    self->error = FW_E_NO_EVENT;
-    return false;
+// returns the offset of a name already in the pool, UINT32_MAX if it is not
+uint32_t fw__name_find(FW* self, const char* str, size_t len){
+  if(self->name_map_capacity == 0) return UINT32_MAX;
+  for(size_t i = fw__name_hash(self, str, len); self->name_map[i] != 0; i = (i+1) & (self->name_map_capacity-1)){
+    uint32_t name = self->name_map[i]-1;
+    if(fw__name(self, name)->len == len && memcmp(fw__name_str(self, name), str, len) == 0){
+      return name;
+    }
   }
+  return UINT32_MAX;
+}
 
-  self->received_events = 0;
-  memset(self->name, 0, sizeof(self->name));
-  memset(self->new_name, 0, sizeof(self->new_name));
-
-#if defined(__linux)
+// returns the offset of the interned name, UINT32_MAX on failure
+uint32_t fw__name_intern(FW* self, const char* str, size_t len){
+  if(len > UINT16_MAX){
+    self->error = FW_E_PATH_TOO_LONG;
+    return UINT32_MAX;
+  }
+  uint32_t found = fw__name_find(self, str, len);
+  if(found != UINT32_MAX){
+    // unreferenced names stay in the pool until it is compacted
+    if(fw__name(self, found)->refs == 0) self->names_dead -= fw__name_size(len);
+    fw__name(self, found)->refs++;
+    return found;
+  }
 
-  while(self->received_events == 0){
-    if(self->bytes_left == 0){
-      int n = read(self->fd, self->event_buffer, sizeof(self->event_buffer));
-      if(n < 0){
-        switch(errno){
-          case EAGAIN: self->error = FW_E_NO_EVENT; break;
-          case EACCES: self->error = FW_E_ACCESS_DENIED; break;
-          case EBADF:  self->error = FW_E_UNKNOWN; break;
-          case EFAULT: self->error = FW_E_BAD_STATE; break;
-          case EINTR:  self->error = FW_E_NO_EVENT; break;
-          case EINVAL: self->error = FW_E_BAD_STATE; break;
-          case EIO:    self->error = FW_E_IO_ERROR; break;
-          default:     self->error = FW_E_UNKNOWN; break;
-        }
-        return false;
-      }
-      self->bytes_left = n;
-    }
-
-    while(self->bytes_left > 0){
-      struct inotify_event* event = (void*)self->event_buffer;
-      switch(event->mask){
-        case IN_CREATE:
-          self->received_events = FW_CREATE;
-          fw__consume_event(self, self->name);
-          return true;
-        case IN_DELETE:
-          self->received_events = FW_DELETE;
-          fw__consume_event(self, self->name);
-          return true;
-        case IN_MODIFY:
-          self->received_events = FW_MODIFY;
-          fw__consume_event(self, self->name);
-          return true;
-        case IN_MOVED_FROM:
-          fw__consume_event(self, self->name);
-          if(strlen(self->new_name) > 0){
-            self->received_events = FW_RENAME;
-            return true;
-          }else if(fw__event_queue_is_empty(self)){
-            self->received_events = FW_RENAME;
-            // new name was not received but
-            // no more events are available
-            self->error = FW_E_INCOMPLETE_EVENT;
-            return true;
-          }
-          break;
-        case IN_MOVED_TO:
-          fw__consume_event(self, self->new_name);
-          if(strlen(self->name) > 0){
-            self->received_events = FW_RENAME;
-            return true;
-          }else if(fw__event_queue_is_empty(self)){
-            self->received_events = FW_RENAME;
-            // old name was not received but
-            // no more events are available
-            self->error = FW_E_INCOMPLETE_EVENT;
-            return true;
-          }
-          break;
-        default: break;
-      }
-    }
+  if(self->names_dead > 4096 && self->names_dead*2 > self->names_size){
+    fw__name_compact(self);
   }
-  return false;
-#elif defined(__WIN32)
 
-  self->received_events = 0;
+  size_t size = fw__name_size(len);
+  if(self->names_size + size >= UINT32_MAX){
+    self->error = FW_E_MEMORY_BUDGET;
+    return UINT32_MAX;
+  }
+  if(!fw__grow(self, (void**)&self->names, &self->names_capacity, 1, self->names_size+size)){
+    return UINT32_MAX;
+  }
+  if((self->name_map_count+1)*2 > self->name_map_capacity){
+    // the new name is appended after the rebuild and inserted below
+    size_t capacity = self->name_map_capacity == 0 ? 64 : self->name_map_capacity*2;
+    if(!fw__name_map_rebuild(self, capacity)) return UINT32_MAX;
+  }
 
-  while(true){
+  uint32_t name = self->names_size;
+  self->names_size += size;
+  fw__name(self, name)->refs = 1;
+  fw__name(self, name)->len = len;
+  memcpy(self->names + name + sizeof(FW__Name), str, len);
+  self->names[name + sizeof(FW__Name) + len] = '\0';
 
-    // get next event
-    if(self->event == NULL){
-      DWORD ret = ReadDirectoryChangesW(
-          self->handle,
-          self->event_buffer,
-          sizeof(self->event_buffer),
-          TRUE,
-          FILE_NOTIFY_CHANGE_FILE_NAME
-          | FILE_NOTIFY_CHANGE_DIR_NAME
-          | FILE_NOTIFY_CHANGE_LAST_WRITE,
-          NULL,
-          &self->event_info,
-          NULL);
-        
-      if(ret == 0){
-        self->error = FW_E_UNKNOWN;
-        return false;
-      }
+  size_t i = fw__name_hash(self, str, len);
+  while(self->name_map[i] != 0) i = (i+1) & (self->name_map_capacity-1);
+  self->name_map[i] = name+1;
+  self->name_map_count++;
+  return name;
+}
 
-      ret = WaitForSingleObject(self->event_info.hEvent, INFINITE);
-      if(ret != WAIT_OBJECT_0){
-        switch(ret){
-          case WAIT_ABANDONED:
-          case WAIT_TIMEOUT: self->error = FW_E_NO_EVENT; break;
-          default: self->error = FW_E_UNKNOWN; break;
-        }
-        return false;
-      }
-      self->event = (FILE_NOTIFY_INFORMATION*)self->event_buffer;
-    }
-
-    DWORD n = 0;
-    GetOverlappedResult(self->handle, &self->event_info, &n, FALSE);
-    switch(self->event->Action){
-      case FILE_ACTION_ADDED:
-        if(self->watch_events & FW_CREATE){
-          self->received_events = FW_CREATE;
-          fw__consume_event(self, self->name);
-          return true;
-        }else{
-          fw__consume_event(self, NULL);
-        }
-        break;
-      case FILE_ACTION_REMOVED:
-        if(self->watch_events & FW_DELETE){
-          self->received_events = FW_DELETE;
-          fw__consume_event(self, self->name);
-          return true;
-        }else{
-          fw__consume_event(self, NULL);
-        }
-        break;
-      case FILE_ACTION_MODIFIED:
-        if(self->watch_events & FW_MODIFY){
-          self->received_events = FW_MODIFY;
-          fw__consume_event(self, self->name);
-          return true;
-        }else{
-          fw__consume_event(self, NULL);
-        }
-        break;
-      case FILE_ACTION_RENAMED_OLD_NAME:
-        if(self->watch_events & FW_RENAME){
-          self->received_events = FW_RENAME;
-          fw__consume_event(self, self->name);
-          if(strlen(self->new_name) > 0){
-            self->received_events = FW_RENAME;
-            return true;
-          }else if(fw__event_queue_is_empty(self)){
-            // new name was not received but
-            // no more events are available
-            self->error = FW_E_INCOMPLETE_EVENT;
-            return true;
-          }
-        }else{
-          fw__consume_event(self, NULL);
-        }
-        break;
-      case FILE_ACTION_RENAMED_NEW_NAME:
-        if(self->watch_events & FW_RENAME){
-          self->received_events = FW_RENAME;
-          fw__consume_event(self, self->new_name);
-          if(strlen(self->name) > 0){
-            return true;
-          }else if(fw__event_queue_is_empty(self)){
-            // old name was not received but
-            // no more events are available
-            self->error = FW_E_INCOMPLETE_EVENT;
-            return true;
-          }
-        }else{
-          fw__consume_event(self, NULL);
-        }
-        break;
-      default: break;
-    }
+void fw__name_release(FW* self, uint32_t name){
+  if(--fw__name(self, name)->refs == 0){
+    self->names_dead += fw__name_size(fw__name(self, name)->len);
   }
+}
 
-  return true;
-#endif
+size_t fw__watch_hash(FW* self, int wd){
+  return ((size_t)(unsigned)wd * 2654435761u) & (self->watch_map_capacity-1);
 }
 
-const char* fw_strerror(FW_Error error){
-  switch (error) {
-    case FW_E_IO_ERROR: return "Platform IO error"; 
-    case FW_E_PLATFORM_LIMIT: return "A platform limitiation has been reached"; 
-    case FW_E_ACCESS_DENIED: return "Access to file/direcoty has been denied"; 
-    case FW_E_BAD_STATE: return "FW is in bad state"; 
-    case FW_E_INVALID_ARGUMENT: return "An invalid argument was provided"; 
-    case FW_E_NO_EVENT: return "No event was available"; 
-    case FW_E_PATH_NOT_FOUND: return "Path not found"; 
-    case FW_E_PATH_TOO_LONG: return "Path is too long"; 
-    case FW_E_UNKNOWN: return "An unknown error occured"; 
-    case FW_E_INCOMPLETE_EVENT: return "An incomplete (FW_RENAME) event was received"; 
+int fw__watch_find(FW* self, int wd){
+  if(self->watch_map_capacity == 0) return -1;
+  for(size_t i = fw__watch_hash(self, wd);; i = (i+1) & (self->watch_map_capacity-1)){
+    int index = self->watch_map[i];
+    if(index < 0) return -1;
+    if(self->watches[index].wd == wd) return index;
   }
-  return "Invalid error code provided to fw_strerror";
 }
 
-FW_Error fw_error(FW* self){
-  return self->error;
+void fw__watch_map_insert(FW* self, int index){
+  size_t i = fw__watch_hash(self, self->watches[index].wd);
+  while(self->watch_map[i] >= 0){
+    i = (i+1) & (self->watch_map_capacity-1);
+  }
+  self->watch_map[i] = index;
 }
 
-FW_Event fw_event(FW* self){
-  return self->received_events;
-}
+void fw__watch_map_remove(FW* self, int wd){
+  size_t mask = self->watch_map_capacity-1;
+  size_t i = fw__watch_hash(self, wd);
+  while(self->watch_map[i] >= 0 && self->watches[self->watch_map[i]].wd != wd){
+    i = (i+1) & mask;
+  }
+  if(self->watch_map[i] < 0) return;
 
-const char* fw_name(FW* self){
-  return self->name;
+  // backward shift so no tombstones are needed
+  for(size_t j = (i+1) & mask; self->watch_map[j] >= 0; j = (j+1) & mask){
+    size_t k = fw__watch_hash(self, self->watches[self->watch_map[j]].wd);
+    bool in_place = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+    if(!in_place){
+      self->watch_map[i] = self->watch_map[j];
+      i = j;
+    }
+  }
+  self->watch_map[i] = -1;
 }
 
-const char* fw_new_name(FW* self){
-  return self->new_name;
+// finds a directory by its parent and name
+int fw__watch_child(FW* self, int parent, const char* name, size_t name_len){
+  uint32_t interned = fw__name_find(self, name, name_len);
+  if(interned == UINT32_MAX || self->watch_map_capacity == 0) return -1;
+  for(size_t i = fw__child_hash(self, parent, interned);; i = (i+1) & (self->watch_map_capacity-1)){
+    int index = self->child_map[i];
+    if(index < 0) return -1;
+    if(self->watches[index].parent == parent && self->watches[index].name == interned) return index;
+  }
 }
 
-bool fw_once(FW* self, const char* path, FW_Event events){
-  if(!fw_init(self, path, events)){
-    return false;
+// must be called before the parent or name of the watch change
+void fw__child_map_remove(FW* self, int index){
+  size_t mask = self->watch_map_capacity-1;
+  size_t i = fw__child_hash(self, self->watches[index].parent, self->watches[index].name);
+  while(self->child_map[i] >= 0 && self->child_map[i] != index){
+    i = (i+1) & mask;
   }
-  if(!fw_watch(self)){
-    return false;
+  if(self->child_map[i] < 0) return;
+
+  for(size_t j = (i+1) & mask; self->child_map[j] >= 0; j = (j+1) & mask){
+    const FW__Watch* watch = &self->watches[self->child_map[j]];
+    size_t k = fw__child_hash(self, watch->parent, watch->name);
+    bool in_place = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+    if(!in_place){
+      self->child_map[i] = self->child_map[j];
+      i = j;
+    }
   }
-  fw_deinit(self);
-  return true;
+  self->child_map[i] = -1;
 }
+
+// adds a watch to the subdirectories of its parent
+void fw__watch_link(FW* self, int index){
+  FW__Watch* watch = &self->watches[index];
+  watch->prev = -1;
+  watch->next = -1;
+  if(watch->parent < 0) return;
+  FW__Watch* parent = &self->watches[watch->parent];
+  watch->next = parent->child;
+  if(parent->child >= 0) self->watches[parent->child].prev = index;
+  parent->child = index;
+}
+
+void fw__watch_unlink(FW* self, int index){
+  FW__Watch* watch = &self->watches[index];
+  if(watch->prev >= 0) self->watches[watch->prev].next = watch->next;
+  else if(watch->parent >= 0) self->watches[watch->parent].child = watch->next;
+  if(watch->next >= 0) self->watches[watch->next].prev = watch->prev;
+  watch->prev = -1;
+  watch->next = -1;
+}
+
+// moves a directory to another parent and name, everything below it
+// follows since paths are only built from the parent links
+bool fw__watch_move(FW* self, int index, int parent, const char* name, size_t name_len){
+  uint32_t interned = fw__name_intern(self, name, name_len);
+  if(interned == UINT32_MAX) return false;
+  fw__child_map_remove(self, index);
+  fw__watch_unlink(self, index);
+  fw__name_release(self, self->watches[index].name);
+  self->watches[index].parent = parent;
+  self->watches[index].name = interned;
+  fw__watch_link(self, index);
+  fw__child_map_insert(self, index);
+  self->tree_version++;
+  FW__STAT_ADD(self, directory_moves, 1);
+  return true;
+}
+
+// returns the index of the new (or already existing) watch, -1 on failure
+int fw__watch_add(FW* self, int wd, int parent, const char* name, size_t name_len){
+  int index = fw__watch_find(self, wd);
+  if(index >= 0) return index;
+  // a path names one directory, the caller drops the one that was replaced
+  if(parent >= 0 && fw__watch_child(self, parent, name, name_len) >= 0) return -1;
+
+  if((size_t)(self->watch_count+1)*2 > self->watch_map_capacity){
+    size_t capacity = self->watch_map_capacity == 0 ? 64 : self->watch_map_capacity*2;
+    size_t both = self->watch_map_capacity*2;
+    if(!fw__grow(self, (void**)&self->watch_map, &both, sizeof(*self->watch_map), capacity*2)){
+      return -1;
+    }
+    self->watch_map_capacity = both/2;
+    self->child_map = self->watch_map + self->watch_map_capacity;
+    memset(self->watch_map, 0xff, sizeof(*self->watch_map)*self->watch_map_capacity);
+    for(size_t i = 0; i < self->watch_capacity; ++i){
+      if(self->watches[i].wd != -1) fw__watch_map_insert(self, i);
+    }
+    fw__child_map_rebuild(self);
+  }
+
+  if(self->watch_free < 0){
+    size_t used = self->watch_count;
+    if(!fw__grow(self, (void**)&self->watches, &self->watch_capacity, sizeof(*self->watches), used+1)){
+      return -1;
+    }
+    for(size_t i = self->watch_capacity; i > used; --i){
+      self->watches[i-1].wd = -1;
+      self->watches[i-1].parent = self->watch_free;
+      self->watch_free = i-1;
+    }
+  }
+
+  uint32_t interned = fw__name_intern(self, name, name_len);
+  if(interned == UINT32_MAX) return -1;
+
+  index = self->watch_free;
+  self->watch_free = self->watches[index].parent;
+  self->watch_count++;
+  FW__STAT_SET(self, watches, self->watch_count);
+
+  self->watches[index].wd = wd;
+  self->watches[index].parent = parent;
+  self->watches[index].name = interned;
+  self->watches[index].active = 0;
+  self->watches[index].child = -1;
+  fw__watch_link(self, index);
+  if((size_t)index < self->stamp_capacity) memset(&self->stamps[index], 0, sizeof(*self->stamps));
+  fw__watch_map_insert(self, index);
+  fw__child_map_insert(self, index);
+  self->tree_version++;
+  return index;
+}
+
+// removes a single watch, subdirectories still below it are left without a
+// parent, fw__watch_drop removes whole subtrees
+void fw__watch_remove(FW* self, int index){
+  if((size_t)index < self->walk_slot_capacity){
+    int slot = self->walk_slots[index];
+    if(slot >= 0 && (size_t)slot < self->walk_count && self->walks[slot].index == index){
+      self->walks[slot].index = -1;
+    }
+    self->walk_slots[index] = -1;
+  }
+  fw__watch_unlink(self, index);
+  for(int child = self->watches[index].child; child >= 0;){
+    int next = self->watches[child].next;
+    self->watches[child].parent = -1;
+    self->watches[child].prev = -1;
+    self->watches[child].next = -1;
+    child = next;
+  }
+  fw__watch_map_remove(self, self->watches[index].wd);
+  fw__child_map_remove(self, index);
+  fw__name_release(self, self->watches[index].name);
+  self->watches[index].wd = -1;
+  self->watches[index].parent = self->watch_free;
+  self->watch_free = index;
+  self->watch_count--;
+  self->tree_version++;
+  FW__STAT_SET(self, watches, self->watch_count);
+}
+
+void fw__path_put(char* buf, size_t size, size_t offset, const char* part, size_t part_len){
+  for(size_t i = 0; i < part_len && offset+i+1 < size; ++i){
+    buf[offset+i] = part[i];
+  }
+}
+
+bool fw__path_needs_separator(FW* self, int index){
+  const FW__Name* name = fw__name(self, self->watches[index].name);
+  return name->len == 0 || fw__name_str(self, self->watches[index].name)[name->len-1] != '/';
+}
+
+// writes the full path of a watch (and optionally a name inside it) to buf
+// and returns its length, like snprintf the result is truncated when buf is
+// too small but the returned length is always the full length
+size_t fw__watch_path(FW* self, int index, const char* name, char* buf, size_t size){
+  size_t name_len = name != NULL ? strlen(name) : 0;
+  size_t len = 0;
+  for(int i = index; i >= 0; i = self->watches[i].parent){
+    int parent = self->watches[i].parent;
+    len += fw__name(self, self->watches[i].name)->len;
+    if(parent >= 0 && fw__path_needs_separator(self, parent)) len += 1;
+  }
+  if(name_len > 0){
+    len += name_len;
+    if(fw__path_needs_separator(self, index)) len += 1;
+  }
+
+  // fill back to front so the tree is only walked upwards
+  size_t end = len;
+  if(name_len > 0){
+    end -= name_len;
+    fw__path_put(buf, size, end, name, name_len);
+    if(fw__path_needs_separator(self, index)){
+      end -= 1;
+      fw__path_put(buf, size, end, "/", 1);
+    }
+  }
+  for(int i = index; i >= 0; i = self->watches[i].parent){
+    int parent = self->watches[i].parent;
+    size_t part_len = fw__name(self, self->watches[i].name)->len;
+    end -= part_len;
+    fw__path_put(buf, size, end, fw__name_str(self, self->watches[i].name), part_len);
+    if(parent >= 0 && fw__path_needs_separator(self, parent)){
+      end -= 1;
+      fw__path_put(buf, size, end, "/", 1);
+    }
+  }
+  if(size > 0) buf[len < size ? len : size-1] = '\0';
+  return len;
+}
+
+uint64_t fw__hash64(const char* str, size_t len){
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t i = 0; i < len; ++i){
+    hash = (hash ^ (uint8_t)str[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+int fw__poll_compare(const void* a, const void* b){
+  uint64_t x = ((const FW__PollEntry*)a)->hash;
+  uint64_t y = ((const FW__PollEntry*)b)->hash;
+  return (x > y) - (x < y);
+}
+
+int fw__watched(FW* self){
+  return self->watch_count - self->poll_count;
+}
+
+// seconds since init as stored in FW__Watch.active, 0 is never
+uint32_t fw__active_now(FW* self){
+  uint64_t now = self->batch_time > self->active_base ? self->batch_time - self->active_base : 0;
+  return (uint32_t)(now/1000000000ull) + 1;
+}
+
+// pinned directories and everything below them keep their kernel watch
+bool fw__pinned(FW* self, const char* path){
+  if(self->pinned_count == 0) return false;
+  size_t root_len = fw__name(self, self->watches[0].name)->len;
+  const char* rel = path + root_len;
+  while(*rel == '/') rel++;
+  const char* pin = self->pinned;
+  for(size_t i = 0; i < self->pinned_count; ++i){
+    size_t len = strlen(pin);
+    size_t pin_len = len;
+    while(pin_len > 0 && pin[pin_len-1] == '/') pin_len--;
+    if(strncmp(rel, pin, pin_len) == 0 && (rel[pin_len] == '\0' || rel[pin_len] == '/')) return true;
+    pin += len+1;
+  }
+  return false;
+}
+
+// queues a synthetic inotify event, names are padded like the kernel does
+bool fw__pending_push(FW* self, int wd, uint32_t mask, const char* name, size_t name_len){
+  size_t len = (name_len + 1 + 15) & ~(size_t)15;
+  size_t size = sizeof(struct inotify_event) + len;
+  if(!fw__grow(self, (void**)&self->pending, &self->pending_capacity, 1, self->pending_size+size)){
+    return false;
+  }
+  struct inotify_event* event = (struct inotify_event*)(self->pending + self->pending_size);
+  memset(event, 0, size);
+  event->wd = wd;
+  event->mask = mask;
+  event->len = (uint32_t)len;
+  memcpy(event->name, name, name_len);
+  self->pending_size += size;
+  return true;
+}
+
+// queued and buffered events of a directory that switched between
+// polling and a kernel watch must follow it to the new wd
+void fw__rewrite_wd(FW* self, int old_wd, int new_wd){
+  for(size_t offset = self->pending_offset; offset < self->pending_size;){
+    struct inotify_event* event = (struct inotify_event*)(self->pending + offset);
+    if(event->wd == old_wd) event->wd = new_wd;
+    offset += sizeof(*event) + event->len;
+  }
+  for(int offset = self->event_offset; offset < self->event_size;){
+    struct inotify_event* event = (struct inotify_event*)(self->event_buffer + offset);
+    if(event->wd == old_wd) event->wd = new_wd;
+    offset += sizeof(*event) + event->len;
+  }
+  for(int i = 0; i < 2; ++i){
+    FW__Lane* lane = &self->lanes[i];
+    for(size_t offset = lane->offset; offset < lane->size;){
+      struct inotify_event* event = (struct inotify_event*)(lane->data + offset);
+      if(event->wd == old_wd) event->wd = new_wd;
+      offset += sizeof(*event) + event->len;
+    }
+  }
+}
+
+int fw__poll_slot(FW* self){
+  if(self->poll_free < 0){
+    size_t used = self->poll_count;
+    if(!fw__grow(self, (void**)&self->polls, &self->poll_capacity, sizeof(*self->polls), used+1)){
+      return -1;
+    }
+    for(size_t i = self->poll_capacity; i > used; --i){
+      memset(&self->polls[i-1], 0, sizeof(*self->polls));
+      self->polls[i-1].index = -1;
+      self->polls[i-1].next_free = self->poll_free;
+      self->poll_free = i-1;
+    }
+  }
+  int slot = self->poll_free;
+  self->poll_free = self->polls[slot].next_free;
+  self->poll_count++;
+  return slot;
+}
+
+void fw__poll_release(FW* self, int slot){
+  FW__Poll* poll = &self->polls[slot];
+  for(size_t i = 0; i < poll->entry_count; ++i){
+    fw__name_release(self, poll->entries[i].name);
+  }
+  FW_FREE(poll->entries);
+  self->poll_entry_bytes -= poll->entry_capacity*sizeof(*poll->entries);
+  memset(poll, 0, sizeof(*poll));
+  poll->index = -1;
+  poll->next_free = self->poll_free;
+  self->poll_free = slot;
+  self->poll_count--;
+}
+
+// forgets a directory that left the tree together with everything below
+// it, the kernel watches are removed since their paths can no longer be
+// built and their IN_IGNORED finds nothing anymore, unless the kernel
+// removed them already (removed)
+bool fw__watch_drop(FW* self, int index, bool removed){
+  int* below = (int*)FW_REALLOC(NULL, sizeof(*below)*self->watch_count);
+  if(below == NULL) return false;
+  // in preorder along the subdirectory links, removed leaves first
+  int count = 0;
+  for(int i = index;;){
+    below[count++] = i;
+    if(self->watches[i].child >= 0){
+      i = self->watches[i].child;
+      continue;
+    }
+    while(i != index && self->watches[i].next < 0) i = self->watches[i].parent;
+    if(i == index) break;
+    i = self->watches[i].next;
+  }
+  while(count > 0){
+    int i = below[--count];
+    int wd = self->watches[i].wd;
+    if(wd < -1) fw__poll_release(self, -2 - wd);
+    else if(!removed) fw__rm_watch(self, wd);
+    fw__watch_remove(self, i);
+  }
+  FW_FREE(below);
+  return true;
+}
+
+// compares a polled directory with its last snapshot and queues the
+// differences as events when emit is set, returns 1 when it changed,
+// 0 when it did not (or could not be read) and -1 when it is gone
+int fw__poll_dir(FW* self, int slot, bool emit){
+  int index = self->polls[slot].index;
+  char path[FW_PATH_MAX];
+  if(fw__watch_path(self, index, NULL, path, sizeof(path)) >= sizeof(path)) return 0;
+
+  // open, getdents and close, large directories take a few more getdents
+  FW__STAT_ADD(self, syscalls, 3);
+  DIR* dir = opendir(path);
+  if(dir == NULL){
+    if(errno != ENOENT && errno != ENOTDIR) return 0;
+    // with everything below it, also the directories with a kernel watch
+    fw__watch_drop(self, index, false);
+    return -1;
+  }
+  size_t count = 0;
+  bool ok = true;
+  struct dirent* entry;
+  while((entry = readdir(dir)) != NULL){
+    const char* name = entry->d_name;
+    if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+    struct stat st;
+    FW__STAT_ADD(self, syscalls, 1);
+    if(fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0) continue;
+    if(!fw__grow(self, (void**)&self->scan, &self->scan_capacity, sizeof(*self->scan), count+1)){
+      ok = false;
+      break;
+    }
+    size_t len = strlen(name);
+    uint32_t interned = fw__name_intern(self, name, len);
+    if(interned == UINT32_MAX){
+      ok = false;
+      break;
+    }
+    FW__PollEntry* scanned = &self->scan[count++];
+    self->scan_count = count;
+    scanned->hash = fw__hash64(name, len);
+    scanned->mtime = (uint64_t)st.st_mtim.tv_sec*1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+    scanned->size = (uint64_t)st.st_size;
+    scanned->name = interned;
+    scanned->dir = S_ISDIR(st.st_mode);
+  }
+  closedir(dir);
+  self->scan_count = 0;
+
+  // the old snapshot is kept when the new one does not fit
+  size_t capacity = self->polls[slot].entry_capacity;
+  if(ok && !fw__grow(self, (void**)&self->polls[slot].entries, &self->polls[slot].entry_capacity, sizeof(*self->scan), count)){
+    ok = false;
+  }
+  self->poll_entry_bytes += (self->polls[slot].entry_capacity - capacity)*sizeof(*self->scan);
+  if(!ok){
+    for(size_t i = 0; i < count; ++i) fw__name_release(self, self->scan[i].name);
+    return 0;
+  }
+  if(count > 1) qsort(self->scan, count, sizeof(*self->scan), fw__poll_compare);
+
+  FW__Poll* poll = &self->polls[slot];
+  int wd = self->watches[index].wd;
+  bool changed = false;
+  size_t i = 0;
+  size_t j = 0;
+  while(i < poll->entry_count || j < count){
+    const FW__PollEntry* old = i < poll->entry_count ? &poll->entries[i] : NULL;
+    const FW__PollEntry* now = j < count ? &self->scan[j] : NULL;
+    const FW__PollEntry* change = NULL;
+    uint32_t mask = 0;
+    if(now != NULL && (old == NULL || now->hash < old->hash)){
+      change = now;
+      mask = IN_CREATE;
+      j++;
+    }else if(old != NULL && (now == NULL || old->hash < now->hash)){
+      change = old;
+      mask = IN_DELETE;
+      i++;
+    }else{
+      if(!now->dir && (now->mtime != old->mtime || now->size != old->size)){
+        change = now;
+        mask = IN_MODIFY;
+      }
+      i++;
+      j++;
+    }
+    if(change == NULL) continue;
+    changed = true;
+    if(emit){
+      if(change->dir) mask |= IN_ISDIR;
+      fw__pending_push(self, wd, mask, fw__name_str(self, change->name), fw__name(self, change->name)->len);
+    }
+  }
+
+  for(size_t k = 0; k < poll->entry_count; ++k){
+    fw__name_release(self, poll->entries[k].name);
+  }
+  if(count > 0) memcpy(poll->entries, self->scan, count*sizeof(*self->scan));
+  poll->entry_count = count;
+  return changed ? 1 : 0;
+}
+
+// starts polling a directory that did not get a kernel watch, its first
+// snapshot is taken without events, returns the index or -1 on failure
+// and -2 when it is gone
+int fw__poll_add(FW* self, int parent, const char* name, size_t name_len){
+  int slot = fw__poll_slot(self);
+  if(slot < 0) return -1;
+  int index = fw__watch_add(self, -2 - slot, parent, name, name_len);
+  if(index < 0){
+    fw__poll_release(self, slot);
+    return -1;
+  }
+  self->polls[slot].index = index;
+  if(fw__poll_dir(self, slot, false) < 0) return -2;
+  return index;
+}
+
+// moves a polled directory to a kernel watch, changes since the last poll
+// are queued when emit is set since the watch only sees what comes after
+bool fw__poll_promote(FW* self, int slot, bool emit){
+  int index = self->polls[slot].index;
+  char path[FW_PATH_MAX];
+  if(fw__watch_path(self, index, NULL, path, sizeof(path)) >= sizeof(path)) return false;
+
+  int wd = fw__add_watch(self, path, fw__inotify_mask(self) | IN_ONLYDIR);
+  if(wd < 0){
+    if(errno == ENOSPC || errno == ENOMEM) self->watch_limit = fw__watched(self);
+    return false;
+  }
+  if(fw__watch_find(self, wd) >= 0) return false;
+  if(emit && fw__poll_dir(self, slot, true) < 0){
+    fw__rm_watch(self, wd);
+    return false;
+  }
+
+  int old_wd = self->watches[index].wd;
+  fw__poll_release(self, slot);
+  fw__watch_map_remove(self, old_wd);
+  self->watches[index].wd = wd;
+  fw__watch_map_insert(self, index);
+  fw__rewrite_wd(self, old_wd, wd);
+  FW__STAT_ADD(self, promotions, 1);
+  return true;
+}
+
+// moves a watched directory to polling, the snapshot is taken before
+// the watch is removed so nothing falls in between
+bool fw__poll_demote(FW* self, int index){
+  int slot = fw__poll_slot(self);
+  if(slot < 0) return false;
+  int old_wd = self->watches[index].wd;
+  self->polls[slot].index = index;
+  fw__watch_map_remove(self, old_wd);
+  self->watches[index].wd = -2 - slot;
+  fw__watch_map_insert(self, index);
+  fw__rewrite_wd(self, old_wd, -2 - slot);
+  fw__poll_dir(self, slot, false);
+  // the IN_IGNORED this causes is dropped since the wd is no longer known
+  fw__rm_watch(self, old_wd);
+  FW__STAT_ADD(self, demotions, 1);
+  return true;
+}
+
+// the least recently active watched directory that may be demoted
+int fw__watch_coldest(FW* self){
+  int coldest = -1;
+  for(size_t i = 0; i < self->watch_capacity; ++i){
+    const FW__Watch* watch = &self->watches[i];
+    if(watch->wd < 0 || i == 0 || watch->active == UINT32_MAX) continue;
+    if(coldest < 0 || watch->active < self->watches[coldest].active) coldest = i;
+  }
+  return coldest;
+}
+
+// frees a kernel watch for a directory last active at the given time when
+// at the limit, only directories that were quiet for longer are demoted
+bool fw__poll_make_room(FW* self, uint32_t active){
+  if(self->watch_limit == 0 || (size_t)fw__watched(self) < self->watch_limit) return true;
+  int coldest = fw__watch_coldest(self);
+  if(coldest < 0 || self->watches[coldest].active >= active) return false;
+  return fw__poll_demote(self, coldest);
+}
+
+// polls every directory without a kernel watch, changed ones are
+// promoted in place of the coldest watched directories
+void fw__poll_all(FW* self){
+  int promotions = 0;
+  uint32_t now = fw__active_now(self);
+  for(size_t slot = 0; slot < self->poll_capacity; ++slot){
+    int index = self->polls[slot].index;
+    if(index < 0) continue;
+    if(fw__poll_dir(self, slot, true) <= 0) continue;
+    if(self->watches[index].active != UINT32_MAX) self->watches[index].active = now;
+    if(promotions < FW__POLL_PROMOTIONS && fw__poll_make_room(self, self->watches[index].active)){
+      if(fw__poll_promote(self, slot, true)) promotions++;
+    }
+  }
+  FW__STAT_ADD(self, polls, 1);
+}
+
+typedef struct{
+  uint64_t key;
+  int index;
+} FW__Rank;
+
+int fw__rank_compare(const void* a, const void* b){
+  uint64_t x = ((const FW__Rank*)a)->key;
+  uint64_t y = ((const FW__Rank*)b)->key;
+  return (x < y) - (x > y);
+}
+
+// after the initial walk the watches go to the pinned and then the most
+// recently modified directories instead of the ones walked first
+void fw__poll_rebalance(FW* self){
+  FW__Rank* ranks = (FW__Rank*)FW_REALLOC(NULL, sizeof(*ranks)*self->watch_capacity);
+  if(ranks == NULL) return;
+  size_t count = 0;
+  char path[FW_PATH_MAX];
+  for(size_t i = 0; i < self->watch_capacity; ++i){
+    const FW__Watch* watch = &self->watches[i];
+    if(watch->wd == -1 || i == 0) continue;
+    uint64_t key = UINT64_MAX;
+    struct stat st;
+    if(watch->active != UINT32_MAX){
+      key = 0;
+      FW__STAT_ADD(self, syscalls, 1);
+      if(fw__watch_path(self, i, NULL, path, sizeof(path)) < sizeof(path) && stat(path, &st) == 0){
+        key = (uint64_t)st.st_mtim.tv_sec*1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+      }
+    }
+    ranks[count].key = key;
+    ranks[count].index = i;
+    count++;
+  }
+  qsort(ranks, count, sizeof(*ranks), fw__rank_compare);
+
+  // the root always keeps its watch
+  size_t allowed = self->watch_limit - 1;
+  for(size_t i = allowed; i < count; ++i){
+    if(self->watches[ranks[i].index].wd >= 0) fw__poll_demote(self, ranks[i].index);
+  }
+  for(size_t i = 0; i < allowed && i < count; ++i){
+    int wd = self->watches[ranks[i].index].wd;
+    if(wd < -1) fw__poll_promote(self, -2 - wd, false);
+  }
+  FW_FREE(ranks);
+}
+
+// reads the per user watch limit, 0 when it is unknown
+size_t fw__max_user_watches(void){
+  int fd = open("/proc/sys/fs/inotify/max_user_watches", O_RDONLY | O_CLOEXEC);
+  if(fd < 0) return 0;
+  char buf[32];
+  ssize_t n = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  size_t limit = 0;
+  for(ssize_t i = 0; i < n && buf[i] >= '0' && buf[i] <= '9'; ++i){
+    limit = limit*10 + (buf[i] - '0');
+  }
+  return limit;
+}
+
+// adds a directory below parent to the tree, with a kernel watch while
+// under the watch limit and polled after that, returns the index, -1 on
+// failure and -2 for directories that are skipped, known is set to the
+// index of a directory that already was in the tree
+int fw__watch_dir(FW* self, int parent, const char* name, const char* path, int* known){
+  size_t name_len = strlen(name);
+  uint32_t active = fw__pinned(self, path) ? UINT32_MAX : 0;
+  if(active == UINT32_MAX) fw__poll_make_room(self, active);
+  if(self->watch_limit == 0 || (size_t)fw__watched(self) < self->watch_limit){
+    int wd = fw__add_watch(self, path, fw__inotify_mask(self) | IN_ONLYDIR);
+    if(wd >= 0){
+      // already known (bind mounts, a directory that was walked twice or
+      // one that was moved)
+      int index = fw__watch_find(self, wd);
+      if(index >= 0){
+        if(known != NULL) *known = index;
+        return -2;
+      }
+      // the directory that had this path before was moved away unseen
+      int stale = fw__watch_child(self, parent, name, name_len);
+      if(stale > 0) fw__watch_drop(self, stale, false);
+      index = fw__watch_add(self, wd, parent, name, name_len);
+      if(index < 0){
+        fw__rm_watch(self, wd);
+        return -1;
+      }
+      self->watches[index].active = active;
+      return index;
+    }
+    // gone again or not a directory
+    if(errno != ENOSPC && errno != ENOMEM) return -2;
+    // other inotify instances of the user took the rest
+    self->watch_limit = fw__watched(self);
+  }
+  int stale = fw__watch_child(self, parent, name, name_len);
+  if(stale > 0) fw__watch_drop(self, stale, false);
+  int index = fw__poll_add(self, parent, name, name_len);
+  if(index >= 0) self->watches[index].active = active;
+  return index;
+}
+
+bool fw__walk_before(const FW__Walk* a, const FW__Walk* b){
+  if(a->depth != b->depth) return a->depth < b->depth;
+  return a->mtime > b->mtime;
+}
+
+// stores a walk at a position of the heap, which its watch remembers
+void fw__walk_put(FW* self, size_t i, const FW__Walk* walk){
+  self->walks[i] = *walk;
+  if(walk->index >= 0) self->walk_slots[walk->index] = (int)i;
+}
+
+bool fw__walk_push(FW* self, int index, uint32_t depth, uint64_t mtime, int record){
+  if(!fw__grow(self, (void**)&self->walks, &self->walk_capacity, sizeof(*self->walks), self->walk_count+1)){
+    return false;
+  }
+  size_t capacity = self->walk_slot_capacity;
+  if(!fw__grow(self, (void**)&self->walk_slots, &self->walk_slot_capacity, sizeof(*self->walk_slots), index+1)){
+    return false;
+  }
+  memset(self->walk_slots + capacity, 0xff, (self->walk_slot_capacity - capacity)*sizeof(*self->walk_slots));
+  size_t i = self->walk_count++;
+  FW__Walk walk = {mtime, index, depth, record};
+  while(i > 0 && fw__walk_before(&walk, &self->walks[(i-1)/2])){
+    fw__walk_put(self, i, &self->walks[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  fw__walk_put(self, i, &walk);
+  return true;
+}
+
+FW__Walk fw__walk_pop(FW* self){
+  FW__Walk top = self->walks[0];
+  if(top.index >= 0) self->walk_slots[top.index] = -1;
+  FW__Walk last = self->walks[--self->walk_count];
+  size_t i = 0;
+  while(true){
+    size_t child = 2*i + 1;
+    if(child >= self->walk_count) break;
+    if(child+1 < self->walk_count && fw__walk_before(&self->walks[child+1], &self->walks[child])) child++;
+    if(!fw__walk_before(&self->walks[child], &last)) break;
+    fw__walk_put(self, i, &self->walks[child]);
+    i = child;
+  }
+  if(self->walk_count > 0) fw__walk_put(self, i, &last);
+  return top;
+}
+
+uint32_t fw__watch_depth(FW* self, int index){
+  uint32_t depth = 0;
+  for(int i = self->watches[index].parent; i >= 0; i = self->watches[i].parent) depth++;
+  return depth;
+}
+
+size_t fw__inventory_pad(size_t root_len){
+  return (root_len + 7) & ~(size_t)7;
+}
+
+FW__InventoryRecord* fw__inventory_record(FW* self, int record){
+  return (FW__InventoryRecord*)(self->inventory + sizeof(FW__InventoryHeader)
+      + fw__inventory_pad(((FW__InventoryHeader*)self->inventory)->root_len)) + record;
+}
+
+const char* fw__inventory_name(FW* self, const FW__InventoryRecord* record){
+  const FW__InventoryHeader* header = (const FW__InventoryHeader*)self->inventory;
+  return (const char*)fw__inventory_record(self, header->record_count) + record->name;
+}
+
+// finds the record of a subdirectory in the one of its parent
+int fw__inventory_child(FW* self, int parent, const char* name){
+  if(parent < 0) return -1;
+  const FW__InventoryRecord* record = fw__inventory_record(self, parent);
+  size_t len = strlen(name);
+  for(uint32_t i = 0; i < record->child_count; ++i){
+    const FW__InventoryRecord* child = fw__inventory_record(self, record->first_child + i);
+    if(child->name_len == len && memcmp(fw__inventory_name(self, child), name, len) == 0){
+      return record->first_child + i;
+    }
+  }
+  return -1;
+}
+
+// remembers which state of a directory its entries were read in, a ctime
+// within the last two seconds could still change without changing the
+// ctime (like racily clean files in git) so it is not trusted
+void fw__stamp(FW* self, int index, const struct stat* st){
+  if(self->inventory_path == NULL) return;
+  size_t capacity = self->stamp_capacity;
+  if(!fw__grow(self, (void**)&self->stamps, &self->stamp_capacity, sizeof(*self->stamps), index+1)) return;
+  memset(self->stamps + capacity, 0, (self->stamp_capacity - capacity)*sizeof(*self->stamps));
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t ctime = (uint64_t)st->st_ctim.tv_sec*1000000000ull + (uint64_t)st->st_ctim.tv_nsec;
+  uint64_t realtime = (uint64_t)now.tv_sec*1000000000ull + (uint64_t)now.tv_nsec;
+  self->stamps[index].inode = st->st_ino;
+  self->stamps[index].ctime = ctime + 2000000000ull < realtime ? ctime : 0;
+}
+
+// registers the subdirectories of an unchanged directory from the inventory
+bool fw__walk_cached(FW* self, const FW__Walk* walk, const FW__InventoryRecord* record){
+  for(uint32_t i = 0; i < record->child_count; ++i){
+    int child = record->first_child + i;
+    const FW__InventoryRecord* child_record = fw__inventory_record(self, child);
+    char name[FW_NAME_MAX+1];
+    if(child_record->name_len > FW_NAME_MAX) continue;
+    memcpy(name, fw__inventory_name(self, child_record), child_record->name_len);
+    name[child_record->name_len] = '\0';
+
+    char sub_path[FW_PATH_MAX];
+    if(fw__watch_path(self, walk->index, name, sub_path, sizeof(sub_path)) >= sizeof(sub_path)) continue;
+    int sub_index = fw__watch_dir(self, walk->index, name, sub_path, NULL);
+    if(sub_index == -2) continue;
+    if(sub_index < 0) return false;
+    // the ctime stands in for the mtime that orders lazy registration
+    if(!fw__walk_push(self, sub_index, walk->depth+1, child_record->ctime, child)) return false;
+  }
+  FW__STAT_ADD(self, inventory_hits, 1);
+  return true;
+}
+
+// adds watches for the subdirectories of one directory and queues them
+bool fw__walk_dir(FW* self, const FW__Walk* walk){
+  char path[FW_PATH_MAX];
+  if(fw__watch_path(self, walk->index, NULL, path, sizeof(path)) >= sizeof(path)){
+    self->error = FW_E_PATH_TOO_LONG;
+    return false;
+  }
+
+  // a directory with the same inode and ctime still has the same entries
+  struct stat dir_st;
+  if(walk->record >= 0) FW__STAT_ADD(self, syscalls, 1);
+  if(walk->record >= 0 && lstat(path, &dir_st) == 0){
+    FW__InventoryRecord* record = fw__inventory_record(self, walk->record);
+    uint64_t ctime = (uint64_t)dir_st.st_ctim.tv_sec*1000000000ull + (uint64_t)dir_st.st_ctim.tv_nsec;
+    if(record->ctime != 0 && record->inode == dir_st.st_ino && record->ctime == ctime){
+      fw__stamp(self, walk->index, &dir_st);
+      return fw__walk_cached(self, walk, record);
+    }
+  }
+
+  FW__STAT_ADD(self, syscalls, 3);
+  DIR* dir = opendir(path);
+  // directories can disappear or be unreadable, skip those
+  if(dir == NULL) return true;
+  // taken before the entries are read so a change in between is seen as one
+  if(self->inventory_path != NULL) FW__STAT_ADD(self, syscalls, 1);
+  if(self->inventory_path != NULL && fstat(dirfd(dir), &dir_st) == 0){
+    fw__stamp(self, walk->index, &dir_st);
+  }
+  bool ok = true;
+  struct dirent* entry;
+  while((entry = readdir(dir)) != NULL){
+    const char* name = entry->d_name;
+    if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+    char sub_path[FW_PATH_MAX];
+    size_t sub_len = fw__watch_path(self, walk->index, name, sub_path, sizeof(sub_path));
+    if(sub_len >= sizeof(sub_path)) continue;
+
+    // the order only matters when the tree is registered lazily
+    struct stat st;
+    st.st_mtim.tv_sec = 0;
+    st.st_mtim.tv_nsec = 0;
+    if(entry->d_type == DT_UNKNOWN || (self->flags & FW_LAZY)){
+      FW__STAT_ADD(self, syscalls, 1);
+      if(lstat(sub_path, &st) < 0 || !S_ISDIR(st.st_mode)) continue;
+    }else if(entry->d_type != DT_DIR){
+      continue;
+    }
+
+    int sub_index = fw__watch_dir(self, walk->index, name, sub_path, NULL);
+    if(sub_index == -2) continue;
+    if(sub_index < 0){
+      ok = false;
+      break;
+    }
+    uint64_t mtime = (uint64_t)st.st_mtim.tv_sec*1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+    // subdirectories of a changed directory can still be unchanged
+    int record = fw__inventory_child(self, walk->record, name);
+    if(!fw__walk_push(self, sub_index, walk->depth+1, mtime, record)){
+      ok = false;
+      break;
+    }
+  }
+  closedir(dir);
+  return ok;
+}
+
+// loads the inventory of an earlier run of the same root, a missing or
+// invalid file only means the tree is walked completely
+void fw__inventory_load(FW* self, const char* path, const char* root, size_t root_len){
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) return;
+  struct stat st;
+  char* data = NULL;
+  size_t size = 0;
+  if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(FW__InventoryHeader)){
+    size = st.st_size;
+    data = (char*)FW_REALLOC(NULL, size);
+  }
+  size_t done = 0;
+  while(data != NULL && done < size){
+    ssize_t n = read(fd, data + done, size - done);
+    if(n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  if(data == NULL) return;
+
+  bool ok = done == size;
+  const FW__InventoryHeader* header = (const FW__InventoryHeader*)data;
+  ok = ok && memcmp(header->magic, "FWI1", 4) == 0 && header->version == 1;
+  ok = ok && header->root_len == root_len && header->record_count > 0 && header->record_count < UINT32_MAX;
+  ok = ok && size == sizeof(*header) + fw__inventory_pad(header->root_len)
+      + header->record_count*sizeof(FW__InventoryRecord) + header->names_size;
+  // an inventory of another tree, or a corrupt one, is ignored
+  ok = ok && memcmp(data + sizeof(*header), root, root_len) == 0;
+  const FW__InventoryRecord* records = (const FW__InventoryRecord*)(data + sizeof(*header) + fw__inventory_pad(root_len));
+  for(uint64_t i = 0; ok && i < header->record_count; ++i){
+    ok = (uint64_t)records[i].name + records[i].name_len <= header->names_size
+      && (uint64_t)records[i].first_child + records[i].child_count <= header->record_count
+      && (records[i].child_count == 0 || records[i].first_child > i);
+  }
+  // the records are only read until the walk is done
+  if(ok && self->memory_budget > 0 && fw__memory_used(self) + size > self->memory_budget) ok = false;
+  if(!ok){
+    FW_FREE(data);
+    return;
+  }
+  self->inventory = data;
+  self->inventory_size = size;
+}
+
+// walks up to count queued directories, shallowest first
+bool fw__walk(FW* self, size_t count){
+  bool ok = true;
+  for(size_t i = 0; i < count && self->walk_count > 0; ++i){
+    FW__Walk walk = fw__walk_pop(self);
+    if(walk.index < 0) continue;
+    if(!fw__walk_dir(self, &walk)){
+      ok = false;
+      break;
+    }
+  }
+  if(self->walk_count == 0){
+    // only needed again when a directory is added
+    FW_FREE(self->walks);
+    self->walks = NULL;
+    self->walk_capacity = 0;
+    FW_FREE(self->walk_slots);
+    self->walk_slots = NULL;
+    self->walk_slot_capacity = 0;
+    FW_FREE(self->inventory);
+    self->inventory = NULL;
+    self->inventory_size = 0;
+  }
+  if(self->walk_count == 0 && !self->walked){
+    // the watches go to the right directories once the whole tree is known
+    self->walked = true;
+    if(self->poll_count > 0) fw__poll_rebalance(self);
+  }
+  return ok;
+}
+
+// adds watches for all directories below the given watch, with FW_LAZY
+// they are only queued and registered while fw_read runs
+bool fw__watch_tree(FW* self, int root, int record){
+  if(!fw__walk_push(self, root, fw__watch_depth(self, root), 0, record)) return false;
+  if(self->flags & FW_LAZY) return true;
+  if(!fw__walk(self, SIZE_MAX)){
+    self->walk_count = 0;
+    return false;
+  }
+  return true;
+}
+#endif
+
+uint64_t fw__now(void){
+#if defined(__linux)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#elif defined(__WIN32)
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)((double)counter.QuadPart*1e9/frequency.QuadPart);
+#endif
+}
+
+// event timestamps, the coarse clocks only advance every few milliseconds
+// but cost no more than a memory read
+uint64_t fw__batch_now(FW* self){
+  if(self->flags & FW_COARSE_TIME){
+#if defined(__linux)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+#elif defined(__WIN32)
+    return (uint64_t)GetTickCount64()*1000000ull;
+#endif
+  }
+  return fw__now();
+}
+
+size_t fw__histogram_bucket(uint64_t value){
+  if(value < (2u << FW_HISTOGRAM_SUB_BITS)) return value;
+  int shift = 63 - __builtin_clzll(value) - FW_HISTOGRAM_SUB_BITS;
+  return ((size_t)shift << FW_HISTOGRAM_SUB_BITS) + (value >> shift);
+}
+
+uint64_t fw__histogram_value(size_t bucket){
+  if(bucket < (2u << FW_HISTOGRAM_SUB_BITS)) return bucket;
+  int shift = (bucket >> FW_HISTOGRAM_SUB_BITS) - 1;
+  return (uint64_t)(bucket - ((size_t)shift << FW_HISTOGRAM_SUB_BITS)) << shift;
+}
+
+void fw__histogram_record(FW_Histogram* histogram, uint64_t start, uint64_t end){
+  uint64_t value = end > start ? end - start : 0;
+  histogram->buckets[fw__histogram_bucket(value)]++;
+  histogram->count++;
+  if(value > histogram->max) histogram->max = value;
+}
+
+bool fw_init(FW* self, const char* path, FW_Event events){
+  return fw_init_ex(self, path, events, NULL);
+}
+
+#if defined(__linux)
+// a NUL separated copy of a list of paths
+char* fw__paths(FW* self, const char* const* paths, size_t count){
+  size_t size = 0;
+  for(size_t i = 0; i < count; ++i) size += strlen(paths[i]) + 1;
+  char* copy = (char*)FW_REALLOC(NULL, size);
+  if(copy == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
+    return NULL;
+  }
+  char* at = copy;
+  for(size_t i = 0; i < count; ++i){
+    size_t len = strlen(paths[i]);
+    memcpy(at, paths[i], len+1);
+    at += len+1;
+  }
+  return copy;
+}
+
+// the watched path, a symbolic link is watched itself with FW_DONT_FOLLOW
+// and is a file then
+int fw__stat(FW* self, const char* path, struct stat* st){
+  FW__STAT_ADD(self, syscalls, 1);
+  return (self->flags & FW_DONT_FOLLOW) ? lstat(path, st) : stat(path, st);
+}
+
+// splits off the name of a watched file, path_len does not include
+// trailing slashes
+bool fw__file_init(FW* self, const char* path, size_t path_len, const struct stat* st){
+  size_t start = path_len;
+  while(start > 0 && path[start-1] != '/') start--;
+  self->file_name_len = path_len - start;
+  self->file_name = (char*)FW_REALLOC(NULL, self->file_name_len + 1);
+  if(self->file_name == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
+    return false;
+  }
+  memcpy(self->file_name, path + start, self->file_name_len);
+  self->file_name[self->file_name_len] = '\0';
+  self->file_inode = st->st_ino;
+  self->file_device = st->st_dev;
+  self->file_parent_wd = -1;
+  return true;
+}
+#endif
+
+// allocated once the watch is set up so failed inits have nothing to free
+bool fw__latency_init(FW* self){
+  if(!(self->flags & FW_LATENCY)) return true;
+  self->latency = (FW_Latency*)FW_REALLOC(NULL, sizeof(*self->latency));
+  if(self->latency == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
+    return false;
+  }
+  memset(self->latency, 0, sizeof(*self->latency));
+  return true;
+}
+
+bool fw_init_ex(FW* self, const char* path, FW_Event events, const FW_Options* options){
+  memset(self, 0, sizeof(*self));
+  self->watch_events = events;
+  if(options != NULL){
+    self->flags = options->flags;
+    self->memory_budget = options->memory_budget;
+    self->filter = options->filter;
+    self->filter_data = options->filter_data;
+  }
+  if(self->flags & FW_RECURSIVE){
+    self->watch_limit = options->watch_limit;
+    self->poll_interval = options->poll_interval > 0 ? options->poll_interval : FW__POLL_INTERVAL;
+  }
+
+#if defined(__linux)
+
+  self->watch_free = -1;
+  self->lost_wd = -1;
+  self->poll_free = -1;
+  self->event_wd = -1;
+  self->new_event_wd = -1;
+  self->fd = inotify_init1((self->flags & FW_NONBLOCK) ? IN_NONBLOCK : 0);
+
+  if(self->fd < 0){
+    switch(errno){
+      case EINVAL: self->error = FW_E_INVALID_ARGUMENT; break;
+      case ENOMEM: self->error = FW_E_PLATFORM_LIMIT; break;
+      case EMFILE: self->error = FW_E_PLATFORM_LIMIT; break;
+      default: self->error = FW_E_UNKNOWN; break;
+    }
+    return false;
+  }
+
+  size_t path_len = strlen(path);
+  while(path_len > 1 && path[path_len-1] == '/') path_len--;
+  struct stat st;
+  if(fw__stat(self, path, &st) == 0 && !S_ISDIR(st.st_mode) && !(self->flags & FW_ONLYDIR)){
+    if(self->flags & FW_RECURSIVE){
+      self->error = FW_E_INVALID_ARGUMENT;
+      close(self->fd);
+      return false;
+    }
+    if(!fw__file_init(self, path, path_len, &st)){
+      close(self->fd);
+      return false;
+    }
+  }
+
+  // a moved root keeps its watch, which no longer matches its path
+  uint32_t root_events = self->file_name != NULL ? 0 : IN_MOVE_SELF;
+  if(self->flags & FW_ONLYDIR) root_events |= IN_ONLYDIR;
+  self->wd = fw__add_watch(self, path, fw__inotify_mask(self) | root_events);
+  if(self->wd < 0){
+    fw__add_watch_error(self);
+    FW_FREE(self->file_name);
+    close(self->fd);
+    return false;
+  }
+  // from here on fw_deinit cleans up
+  if(!fw__latency_init(self)){
+    fw_deinit(self);
+    return false;
+  }
+
+  if(self->file_name != NULL){
+    // the tree only holds the directory, records carry the file name
+    path_len -= self->file_name_len;
+    if(path_len > 1) path_len--;
+    if(path_len == 0){
+      path = ".";
+      path_len = 1;
+    }
+  }
+  int root = fw__watch_add(self, self->wd, -1, path, path_len);
+  if(root < 0){
+    fw_deinit(self);
+    return false;
+  }
+
+  if(options != NULL && options->priority_count > 0){
+    self->priority = fw__paths(self, options->priority, options->priority_count);
+    self->priority_index = (int*)FW_REALLOC(NULL, sizeof(*self->priority_index)*options->priority_count);
+    if(self->priority == NULL || self->priority_index == NULL){
+      self->error = FW_E_PLATFORM_LIMIT;
+      fw_deinit(self);
+      return false;
+    }
+    self->priority_count = options->priority_count;
+  }
+
+  if(self->flags & FW_RECURSIVE){
+    if(self->watch_limit == 0) self->watch_limit = fw__max_user_watches();
+    if(options->pinned_count > 0){
+      self->pinned = fw__paths(self, options->pinned, options->pinned_count);
+      if(self->pinned == NULL){
+        fw_deinit(self);
+        return false;
+      }
+      self->pinned_count = options->pinned_count;
+    }
+    self->active_base = fw__now();
+    int record = -1;
+    if(options->inventory != NULL){
+      size_t len = strlen(options->inventory);
+      self->inventory_path = (char*)FW_REALLOC(NULL, len+1);
+      if(self->inventory_path == NULL){
+        self->error = FW_E_PLATFORM_LIMIT;
+        fw_deinit(self);
+        return false;
+      }
+      memcpy(self->inventory_path, options->inventory, len+1);
+      fw__inventory_load(self, options->inventory, path, path_len);
+      if(self->inventory != NULL) record = 0;
+    }
+    if(!fw__watch_tree(self, root, record)){
+      fw_deinit(self);
+      return false;
+    }
+    self->poll_deadline = fw__now() + (uint64_t)self->poll_interval*1000000ull;
+  }
+  return true;
+
+#elif defined(__WIN32)
+
+  self->root = strdup(path);
+  self->handle = CreateFile(self->root,
+      FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL,
+      OPEN_EXISTING,
+      FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+      NULL);
+
+  if(self->handle == INVALID_HANDLE_VALUE){
+    self->error = FW_E_UNKNOWN;
+    return false;
+  }
+
+  self->event_info.hEvent = CreateEvent(NULL, FALSE, 0, NULL);
+  if(self->event_info.hEvent == INVALID_HANDLE_VALUE){
+    self->error = FW_E_UNKNOWN;
+    return false;
+  }
+  if(!fw__latency_init(self)){
+    fw_deinit(self);
+    return false;
+  }
+
+  return true;
+#endif
+};
+
+void fw_deinit(FW* self){
+  FW_FREE(self->latency);
+  self->latency = NULL;
+#if defined(__linux)
+  FW_FREE(self->inventory_path);
+  FW_FREE(self->inventory);
+  FW_FREE(self->stamps);
+  self->inventory_path = NULL;
+  self->inventory = NULL;
+  self->inventory_size = 0;
+  self->stamps = NULL;
+  self->stamp_capacity = 0;
+  // closing the descriptor drops every watch in the tree at once
+  close(self->fd);
+  for(size_t i = 0; i < self->poll_capacity; ++i){
+    FW_FREE(self->polls[i].entries);
+  }
+  FW_FREE(self->polls);
+  FW_FREE(self->scan);
+  FW_FREE(self->pending);
+  FW_FREE(self->pinned);
+  FW_FREE(self->walks);
+  FW_FREE(self->walk_slots);
+  FW_FREE(self->held);
+  FW_FREE(self->held_dirs);
+  FW_FREE(self->file_name);
+  FW_FREE(self->priority);
+  FW_FREE(self->priority_index);
+  FW_FREE(self->lanes[0].data);
+  FW_FREE(self->lanes[1].data);
+  FW_FREE(self->lanes[0].runs);
+  FW_FREE(self->lanes[1].runs);
+  FW_FREE(self->batch_runs);
+  FW_FREE(self->lane_cache);
+  memset(self->lanes, 0, sizeof(self->lanes));
+  self->batch_runs = NULL;
+  self->batch_run_count = 0;
+  self->batch_run_capacity = 0;
+  self->lane_cache = NULL;
+  self->lane_cache_capacity = 0;
+  self->priority = NULL;
+  self->priority_index = NULL;
+  self->priority_count = 0;
+  self->file_name = NULL;
+  self->held = NULL;
+  self->held_size = 0;
+  self->held_capacity = 0;
+  self->held_dropped = 0;
+  self->held_dirs = NULL;
+  self->held_dir_count = 0;
+  self->held_dir_capacity = 0;
+  self->walks = NULL;
+  self->walk_count = 0;
+  self->walk_capacity = 0;
+  self->walk_slots = NULL;
+  self->walk_slot_capacity = 0;
+  self->polls = NULL;
+  self->scan = NULL;
+  self->pending = NULL;
+  self->pinned = NULL;
+  self->pinned_count = 0;
+  self->poll_capacity = 0;
+  self->poll_count = 0;
+  self->poll_free = -1;
+  self->poll_entry_bytes = 0;
+  self->scan_capacity = 0;
+  self->pending_size = 0;
+  self->pending_offset = 0;
+  self->pending_capacity = 0;
+  FW_FREE(self->watches);
+  FW_FREE(self->watch_map);
+  FW_FREE(self->names);
+  FW_FREE(self->name_map);
+  self->watches = NULL;
+  self->watch_map = NULL;
+  self->child_map = NULL;
+  self->names = NULL;
+  self->name_map = NULL;
+  self->watch_count = 0;
+  self->watch_capacity = 0;
+  self->watch_map_capacity = 0;
+  self->names_size = 0;
+  self->names_capacity = 0;
+  self->names_dead = 0;
+  self->name_map_count = 0;
+  self->name_map_capacity = 0;
+#elif defined(__WIN32)
+  CloseHandle(self->handle);
+  free(self->root);
+  self->root = NULL;
+#endif
+}
+
+#if defined(__linux)
+// moves a directory in the tree unless that would make it its own
+// ancestor, which only bind mounts can make look possible
+void fw__watch_reparent(FW* self, int index, int parent, const char* name){
+  for(int i = parent; i >= 0; i = self->watches[i].parent){
+    if(i == index) return;
+  }
+  const FW__Watch* watch = &self->watches[index];
+  size_t name_len = strlen(name);
+  const FW__Name* old_name = fw__name(self, watch->name);
+  if(watch->parent == parent && old_name->len == name_len
+      && memcmp(fw__name_str(self, watch->name), name, name_len) == 0){
+    return;
+  }
+  fw__watch_move(self, index, parent, name, name_len);
+}
+
+// starts watching a directory that was created in or moved into the tree,
+// failing only leaves that directory unwatched so the event is still delivered
+void fw__watch_subdir(FW* self, struct inotify_event* event){
+  int parent = fw__watch_find(self, event->wd);
+  if(parent < 0) return;
+
+  char path[FW_PATH_MAX];
+  if(fw__watch_path(self, parent, event->name, path, sizeof(path)) >= sizeof(path)) return;
+
+  // polled once the watch limit is reached, -2 when it is already gone again
+  int known = -1;
+  int index = fw__watch_dir(self, parent, event->name, path, &known);
+  if(known >= 0){
+    // moved here from a place the rename was not paired with
+    fw__watch_reparent(self, known, parent, event->name);
+    return;
+  }
+  if(index < 0) return;
+  // anything created before the watch was added would be missed otherwise
+  fw__watch_tree(self, index, -1);
+}
+
+// follows a directory renamed within the tree by moving its node, the
+// watches below it keep their wd so nothing else has to change
+void fw__watch_rename(FW* self, struct inotify_event* from, struct inotify_event* to){
+  int from_parent = fw__watch_find(self, from->wd);
+  int to_parent = fw__watch_find(self, to->wd);
+  int index = from_parent >= 0 ? fw__watch_child(self, from_parent, from->name, strlen(from->name)) : -1;
+  if(index < 0 || to_parent < 0){
+    // not registered yet (FW_LAZY) or unknown, treat it as new
+    fw__watch_subdir(self, to);
+    return;
+  }
+  fw__watch_reparent(self, index, to_parent, to->name);
+}
+
+// drops a directory that was moved out of the tree
+void fw__watch_moved_out(FW* self, struct inotify_event* event){
+  int parent = fw__watch_find(self, event->wd);
+  int index = parent >= 0 ? fw__watch_child(self, parent, event->name, strlen(event->name)) : -1;
+  if(index > 0) fw__watch_drop(self, index, false);
+}
+
+// moves as many whole queued poll events as fit into the event buffer
+bool fw__pending_take(FW* self){
+  int size = 0;
+  while(self->pending_offset < self->pending_size){
+    struct inotify_event* event = (struct inotify_event*)(self->pending + self->pending_offset);
+    int event_size = sizeof(*event) + event->len;
+    if(size + event_size > (int)sizeof(self->event_buffer)) break;
+    memcpy(self->event_buffer + size, event, event_size);
+    size += event_size;
+    self->pending_offset += event_size;
+  }
+  if(self->pending_offset == self->pending_size){
+    self->pending_offset = 0;
+    self->pending_size = 0;
+  }
+  if(size == 0) return false;
+  self->event_offset = 0;
+  self->event_size = size;
+  self->batch_run_count = 0;
+  self->batch_time = fw__batch_now(self);
+  if(self->latency != NULL) self->read_time = fw__now();
+  return true;
+}
+
+// whether a run of deletions is held back
+bool fw__holding(FW* self){
+  return self->held_size > 0 || self->held_dir_count > 0;
+}
+
+FW__HeldDir* fw__held_dir_find(FW* self, int wd){
+  if(self->held_dir_capacity == 0) return NULL;
+  size_t mask = self->held_dir_capacity-1;
+  for(size_t i = ((size_t)(unsigned)wd * 2654435761u) & mask;; i = (i+1) & mask){
+    if(self->held_dirs[i].wd == wd) return &self->held_dirs[i];
+    if(self->held_dirs[i].wd == -1) return NULL;
+  }
+}
+
+// finds or adds the entry of a directory, NULL when out of memory
+FW__HeldDir* fw__held_dir(FW* self, int wd){
+  FW__HeldDir* dir = fw__held_dir_find(self, wd);
+  if(dir != NULL) return dir;
+  if((self->held_dir_count+1)*2 > self->held_dir_capacity){
+    size_t capacity = self->held_dir_capacity == 0 ? 64 : self->held_dir_capacity*2;
+    FW__HeldDir* dirs = (FW__HeldDir*)FW_REALLOC(NULL, capacity*sizeof(*dirs));
+    if(dirs == NULL) return NULL;
+    for(size_t i = 0; i < capacity; ++i) dirs[i].wd = -1;
+    FW__HeldDir* old = self->held_dirs;
+    size_t old_capacity = self->held_dir_capacity;
+    self->held_dirs = dirs;
+    self->held_dir_capacity = capacity;
+    for(size_t i = 0; i < old_capacity; ++i){
+      if(old[i].wd == -1) continue;
+      size_t j = ((size_t)(unsigned)old[i].wd * 2654435761u) & (capacity-1);
+      while(dirs[j].wd != -1) j = (j+1) & (capacity-1);
+      dirs[j] = old[i];
+    }
+    FW_FREE(old);
+  }
+  size_t mask = self->held_dir_capacity-1;
+  size_t i = ((size_t)(unsigned)wd * 2654435761u) & mask;
+  while(self->held_dirs[i].wd != -1) i = (i+1) & mask;
+  dir = &self->held_dirs[i];
+  dir->wd = wd;
+  dir->last = 0;
+  dir->absorbed = 0;
+  dir->removed = false;
+  self->held_dir_count++;
+  return dir;
+}
+
+// drops the dropped events from the run and chains the rest again
+void fw__held_compact(FW* self){
+  for(size_t i = 0; i < self->held_dir_capacity; ++i) self->held_dirs[i].last = 0;
+  size_t size = 0;
+  for(size_t at = 0; at < self->held_size;){
+    struct inotify_event* event = (struct inotify_event*)(self->held + at);
+    size_t event_size = sizeof(*event) + event->len;
+    at += event_size;
+    if(event->mask == 0) continue;
+    memmove(self->held + size, event, event_size);
+    event = (struct inotify_event*)(self->held + size);
+    FW__HeldDir* dir = fw__held_dir_find(self, event->wd);
+    event->cookie = dir->last;
+    dir->last = (uint32_t)size + 1;
+    size += event_size;
+  }
+  self->held_size = size;
+  self->held_dropped = 0;
+}
+
+// releases the held deletions ahead of the rest of the event buffer (from
+// offset on) and the queued events, the deletion of the topmost directory
+// that was removed with its contents is marked as such and the directories
+// removed during the run leave the tree at once
+void fw__release(FW* self, int offset){
+  size_t size = 0;
+  for(size_t at = 0; at < self->held_size;){
+    struct inotify_event* event = (struct inotify_event*)(self->held + at);
+    size_t event_size = sizeof(*event) + event->len;
+    at += event_size;
+    if(event->mask == 0) continue;
+    event->cookie = 0;
+    if(event->mask & IN_ISDIR){
+      // the directory itself was removed after everything in it
+      int parent = fw__watch_find(self, event->wd);
+      int child = parent >= 0 ? fw__watch_child(self, parent, event->name, strlen(event->name)) : -1;
+      FW__HeldDir* dir = child >= 0 ? fw__held_dir_find(self, self->watches[child].wd) : NULL;
+      if(dir != NULL && dir->removed && dir->absorbed > 0) event->mask |= FW__IN_TREE;
+    }
+    event->mask |= FW__IN_RELEASED;
+    memmove(self->held + size, event, event_size);
+    size += event_size;
+  }
+
+  // the kernel removed their watches already, their IN_IGNORED was taken
+  for(size_t i = 0; i < self->held_dir_capacity; ++i){
+    const FW__HeldDir* dir = &self->held_dirs[i];
+    if(dir->wd == -1 || !dir->removed) continue;
+    int index = fw__watch_find(self, dir->wd);
+    if(index > 0) fw__watch_drop(self, index, true);
+  }
+  for(size_t i = 0; i < self->held_dir_capacity; ++i) self->held_dirs[i].wd = -1;
+  self->held_dir_count = 0;
+  self->held_dropped = 0;
+
+  // the unread rest of the buffer follows, then the already queued events
+  size_t rest = self->event_size - offset;
+  size_t queued = self->pending_size - self->pending_offset;
+  size_t total = size + rest + queued;
+  if(fw__grow(self, (void**)&self->pending, &self->pending_capacity, 1, total + self->pending_offset)){
+    // the run may consist of removed directories only, with nothing held
+    if(queued > 0) memmove(self->pending + size + rest, self->pending + self->pending_offset, queued);
+    if(rest > 0) memcpy(self->pending + size, self->event_buffer + offset, rest);
+    if(size > 0) memcpy(self->pending, self->held, size);
+    self->pending_offset = 0;
+    self->pending_size = size + rest + queued;
+    self->event_offset = self->event_size;
+  }else{
+    // the run is lost like on a kernel queue overflow
+    FW__STAT_ADD(self, overflows, 1);
+  }
+  self->held_size = 0;
+}
+
+// holds back a deletion as part of a run that may turn out to be a whole
+// directory tree, false when it has to be delivered right away, the
+// removal of a directory (IN_IGNORED) drops the deletions held in it
+bool fw__hold(FW* self, struct inotify_event* event){
+  if(event->mask & IN_IGNORED){
+    // the root is lost rather than part of a tree
+    if(event->wd == self->wd || event->wd == self->lost_wd || (event->mask & FW__IN_ROOT)) return false;
+    FW__HeldDir* dir = fw__held_dir(self, event->wd);
+    if(dir == NULL) return false;
+    for(uint32_t at = dir->last; at != 0;){
+      struct inotify_event* held = (struct inotify_event*)(self->held + at-1);
+      at = held->cookie;
+      held->mask = 0;
+      self->held_dropped += sizeof(*held) + held->len;
+      dir->absorbed++;
+    }
+    FW__STAT_ADD(self, events_parsed, dir->absorbed + 1);
+    FW__STAT_ADD(self, events_filtered, dir->absorbed + 1);
+    FW__STAT_ADD(self, deletes_collapsed, dir->absorbed);
+    dir->last = 0;
+    dir->removed = true;
+    self->hold_deadline = self->batch_time + FW__HOLD_TIME*1000000ull;
+    return true;
+  }
+
+  size_t event_size = sizeof(*event) + event->len;
+  if(self->held_dropped*2 > self->held_size) fw__held_compact(self);
+  if(self->held_size - self->held_dropped + event_size > FW__HOLD_MAX) return false;
+  if(!fw__grow(self, (void**)&self->held, &self->held_capacity, 1, self->held_size + event_size)){
+    return false;
+  }
+  FW__HeldDir* dir = fw__held_dir(self, event->wd);
+  if(dir == NULL) return false;
+  struct inotify_event* held = (struct inotify_event*)(self->held + self->held_size);
+  memcpy(held, event, event_size);
+  held->cookie = dir->last;
+  dir->last = (uint32_t)self->held_size + 1;
+  self->held_size += event_size;
+  self->hold_deadline = self->batch_time + FW__HOLD_TIME*1000000ull;
+  return true;
+}
+
+// the work fw_read does besides reading, false if the walk failed
+bool fw__tick(FW* self, uint64_t now){
+  if(self->walk_count > 0 && !fw__walk(self, FW__WALK_STEP)) return false;
+  if(self->poll_count > 0 && now >= self->poll_deadline){
+    self->batch_time = fw__batch_now(self);
+    fw__poll_all(self);
+    self->poll_deadline = now + (uint64_t)self->poll_interval*1000000ull;
+  }
+  // the deletions stopped, release them
+  if(fw__holding(self) && now >= self->hold_deadline) fw__release(self, self->event_size);
+  return true;
+}
+
+// registers queued directories and polls the ones without a kernel watch
+// whenever their interval is over until the inotify descriptor is readable,
+// returns 1 when it is, 0 when a batch of poll events is ready and -1 on error
+int fw__wait(FW* self){
+  while(true){
+    uint64_t now = fw__now();
+    if(!fw__tick(self, now)) return -1;
+    if(fw__pending_take(self)) return 0;
+
+    int timeout = -1;
+    if((self->flags & FW_NONBLOCK) || self->walk_count > 0){
+      timeout = 0;
+    }else if(self->poll_count > 0){
+      timeout = (int)((self->poll_deadline - now + 999999)/1000000);
+    }
+    if(fw__holding(self) && timeout != 0){
+      int hold = (int)((self->hold_deadline - now + 999999)/1000000);
+      if(timeout < 0 || hold < timeout) timeout = hold;
+    }
+    struct pollfd pfd;
+    pfd.fd = self->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    FW__STAT_ADD(self, syscalls, 1);
+    int n = poll(&pfd, 1, timeout);
+    if(n > 0) return 1;
+    if(n < 0 && errno != EINTR){
+      self->error = FW_E_UNKNOWN;
+      return -1;
+    }
+    if(n < 0 || (self->flags & FW_NONBLOCK)){
+      self->error = FW_E_NO_EVENT;
+      return -1;
+    }
+  }
+}
+
+// marks the directory of an event as active so it keeps its watch
+void fw__touch(FW* self, int wd){
+  int index = fw__watch_find(self, wd);
+  if(index >= 0 && self->watches[index].active != UINT32_MAX){
+    self->watches[index].active = fw__active_now(self);
+  }
+}
+
+// finds the IN_MOVED_TO half of a rename in the rest of the batch
+struct inotify_event* fw__find_moved_to(FW* self, uint32_t cookie){
+  for(int offset = self->event_offset; offset < self->event_size;){
+    struct inotify_event* event = (struct inotify_event*)(self->event_buffer + offset);
+    if((event->mask & IN_MOVED_TO) && event->cookie == cookie) return event;
+    offset += sizeof(*event) + event->len;
+  }
+  return NULL;
+}
+#elif defined(__WIN32)
+// converts the name of an event to a narrow string in place, which is
+// safe since every narrow character is written at or before its source
+const char* fw__narrow_name(FILE_NOTIFY_INFORMATION* event, size_t* len){
+  // TODO: handle non ascii names
+  char* name = (char*)event->FileName;
+  DWORD name_len = event->FileNameLength/sizeof(WCHAR);
+  for(DWORD i = 0; i < name_len; ++i){
+    name[i] = (char)event->FileName[i];
+  }
+  name[name_len] = '\0';
+  *len = name_len;
+  return name;
+}
+
+FILE_NOTIFY_INFORMATION* fw__pop_event(FW* self){
+  FILE_NOTIFY_INFORMATION* event = self->event;
+  FW_TRACE(consume, 0, (int)event->NextEntryOffset);
+  if(event->NextEntryOffset != 0){
+    self->event = (FILE_NOTIFY_INFORMATION*)(((char*)event) + event->NextEntryOffset);
+  }else{
+    self->event = NULL;
+  }
+  return event;
+}
+#endif
+
+void fw__parsed(FW* self){
+  FW__STAT_ADD(self, events_parsed, 1);
+  if(self->latency != NULL){
+    self->parse_time = fw__now();
+    fw__histogram_record(&self->latency->read_to_parse, self->read_time, self->parse_time);
+  }
+}
+
+// whether the filter of the options drops the event before it is delivered
+bool fw__filtered(FW* self, const FW_Record* record){
+  if(self->filter == NULL) return false;
+  if(self->filter(record->name, record->name_len, self->filter_data)) return false;
+  if(record->event == FW_RENAME && self->filter(record->new_name, record->new_name_len, self->filter_data)){
+    return false;
+  }
+  FW__STAT_ADD(self, events_filtered, 1);
+  return true;
+}
+
+bool fw__deliver(FW* self, FW_Record* record){
+  bool incomplete = false;
+  if(record->event == FW_RENAME){
+    incomplete = record->name_len == 0 || record->new_name_len == 0;
+    if(incomplete) FW__STAT_ADD(self, incomplete_renames, 1);
+    FW_TRACE(rename_pair, record->name, record->new_name, incomplete);
+  }
+  // only describes the event it was delivered with
+  if(incomplete) self->error = FW_E_INCOMPLETE_EVENT;
+  else if(self->error == FW_E_INCOMPLETE_EVENT) self->error = FW_E_UNKNOWN;
+  record->time = self->batch_time;
+  FW__STAT_ADD(self, events_delivered, 1);
+  FW_TRACE(deliver, record->event, record->name);
+  return true;
+}
+
+#if defined(__linux)
+#define FW__LANE_MAX (1 << 20) // bytes drained from the kernel ahead of fw_read
+#define FW__EVENT_MAX (sizeof(struct inotify_event) + FW_NAME_MAX + 1)
+// while bulk events wait, a batch keeps room for at least one of them so
+// a steady stream of priority events cannot starve the rest
+#define FW__PRIORITY_SHARE (sizeof(((FW*)0)->event_buffer) - FW__EVENT_MAX)
+
+size_t fw__lanes_size(FW* self){
+  return self->lanes[0].size - self->lanes[0].offset
+    + self->lanes[1].size - self->lanes[1].offset;
+}
+
+bool fw__priority_dir(FW* self, int index){
+  for(size_t i = 0; i < self->priority_count; ++i){
+    if(self->priority_index[i] == index) return true;
+  }
+  return false;
+}
+
+// whether a watch is one of the priority directories or below one, the
+// answer is cached on the watches walked until the tree changes
+bool fw__priority(FW* self, int wd){
+  int index = fw__watch_find(self, wd);
+  if(index < 0) return false;
+  if(self->lane_version != self->tree_version || self->lane_cache_capacity < self->watch_capacity){
+    size_t capacity = self->lane_cache_capacity;
+    if(!fw__grow(self, (void**)&self->lane_cache, &capacity, 1, self->watch_capacity)){
+      for(; index >= 0; index = self->watches[index].parent){
+        if(fw__priority_dir(self, index)) return true;
+      }
+      return false;
+    }
+    self->lane_cache_capacity = capacity;
+    memset(self->lane_cache, 0, capacity);
+    self->lane_version = self->tree_version;
+  }
+  // up to the first directory whose lane is known
+  uint8_t lane = 2;
+  int known = index;
+  for(; known >= 0; known = self->watches[known].parent){
+    if(self->lane_cache[known] != 0){
+      lane = self->lane_cache[known];
+      break;
+    }
+    if(fw__priority_dir(self, known)){
+      lane = 1;
+      break;
+    }
+  }
+  for(int i = index; i != known; i = self->watches[i].parent) self->lane_cache[i] = lane;
+  if(known >= 0) self->lane_cache[known] = lane;
+  return lane == 1;
+}
+
+void fw__priority_resolve(FW* self){
+  const char* path = self->priority;
+  for(size_t i = 0; i < self->priority_count; ++i){
+    int index = 0;
+    const char* name = path;
+    while(index >= 0 && *name != '\0'){
+      size_t len = 0;
+      while(name[len] != '\0' && name[len] != '/') len++;
+      if(len > 0 && !(len == 1 && name[0] == '.')) index = fw__watch_child(self, index, name, len);
+      name += len;
+      while(*name == '/') name++;
+    }
+    // directories may be created, moved or deleted at any time
+    if(self->priority_index[i] != index) self->tree_version++;
+    self->priority_index[i] = index;
+    path += strlen(path) + 1;
+  }
+}
+
+// appends to the last run when it has the same times
+bool fw__run_push(FW* self, FW__Run** runs, size_t* count, size_t* capacity, const FW__Run* run){
+  if(*count > 0 && (*runs)[*count-1].time == run->time && (*runs)[*count-1].read_time == run->read_time){
+    (*runs)[*count-1].end = run->end;
+    return true;
+  }
+  if(!fw__grow(self, (void**)runs, capacity, sizeof(**runs), *count+1)) return false;
+  (*runs)[(*count)++] = *run;
+  return true;
+}
+
+bool fw__lane_push(FW* self, FW__Lane* lane, const struct inotify_event* event, size_t size, const FW__Run* read){
+  if(lane->offset == lane->size){
+    lane->offset = 0;
+    lane->size = 0;
+    lane->run_count = 0;
+    lane->run_first = 0;
+  }
+  if(!fw__grow(self, (void**)&lane->data, &lane->capacity, 1, lane->size + size)) return false;
+  FW__Run run = *read;
+  run.end = lane->size + size;
+  if(!fw__run_push(self, &lane->runs, &lane->run_count, &lane->run_capacity, &run)) return false;
+  memcpy(lane->data + lane->size, event, size);
+  lane->size += size;
+  return true;
+}
+
+// sorts a read into the lanes, the halves of a rename stay together
+void fw__lanes_split(FW* self, const char* data, size_t size, const FW__Run* read){
+  for(size_t offset = 0; offset < size;){
+    const struct inotify_event* event = (const struct inotify_event*)(data + offset);
+    size_t event_size = sizeof(*event) + event->len;
+    bool priority = !(event->mask & IN_Q_OVERFLOW) && fw__priority(self, event->wd);
+    if((event->mask & IN_MOVED_FROM) && offset + event_size < size){
+      const struct inotify_event* to = (const struct inotify_event*)(data + offset + event_size);
+      if((to->mask & IN_MOVED_TO) && to->cookie == event->cookie){
+        priority = priority || fw__priority(self, to->wd);
+        event_size += sizeof(*to) + to->len;
+      }
+    }
+    if(!fw__lane_push(self, &self->lanes[priority ? 0 : 1], event, event_size, read)){
+      // the lanes are over the memory budget, the events are lost
+      FW__STAT_ADD(self, overflows, 1);
+    }
+    offset += event_size;
+  }
+}
+
+// clears the private bits from events read from the kernel, an event left
+// without any bit is skipped like the second half of a delivered rename
+void fw__clear_private(char* data, size_t size){
+  for(size_t offset = 0; offset < size;){
+    struct inotify_event* event = (struct inotify_event*)(data + offset);
+    event->mask &= ~(uint32_t)FW__IN_PRIVATE;
+    offset += sizeof(*event) + event->len;
+  }
+}
+
+// moves everything the kernel has queued into the lanes, up to a limit
+void fw__lanes_drain(FW* self){
+  while(fw__lanes_size(self) < FW__LANE_MAX){
+    int queued = 0;
+    FW__STAT_ADD(self, syscalls, 1);
+    if(ioctl(self->fd, FIONREAD, &queued) < 0 || queued <= 0) break;
+    FW__STAT_ADD(self, syscalls, 1);
+    int n = FW_READ(self->fd, self->event_buffer, sizeof(self->event_buffer));
+    if(n <= 0) break;
+    FW_TRACE(read, self->fd, n);
+    FW__STAT_ADD(self, reads, 1);
+    FW__STAT_ADD(self, bytes_read, n);
+    fw__clear_private(self->event_buffer, n);
+    FW__Run read;
+    read.end = 0;
+    read.time = fw__batch_now(self);
+    read.read_time = self->latency != NULL ? fw__now() : 0;
+    fw__lanes_split(self, self->event_buffer, n, &read);
+  }
+}
+
+// fills the event buffer from the priority lane first
+void fw__lanes_take(FW* self){
+  size_t size = 0;
+  self->batch_run_count = 0;
+  self->batch_run = 0;
+  for(int i = 0; i < 2; ++i){
+    FW__Lane* lane = &self->lanes[i];
+    size_t limit = sizeof(self->event_buffer);
+    if(i == 0 && self->lanes[1].offset < self->lanes[1].size) limit = FW__PRIORITY_SHARE;
+    while(lane->offset < lane->size){
+      struct inotify_event* event = (struct inotify_event*)(lane->data + lane->offset);
+      size_t event_size = sizeof(*event) + event->len;
+      // a rename pair is taken whole
+      if((event->mask & IN_MOVED_FROM) && lane->offset + event_size < lane->size){
+        struct inotify_event* to = (struct inotify_event*)(lane->data + lane->offset + event_size);
+        if((to->mask & IN_MOVED_TO) && to->cookie == event->cookie) event_size += sizeof(*to) + to->len;
+      }
+      if(size + event_size > limit) break;
+      while(lane->runs[lane->run_first].end <= lane->offset) lane->run_first++;
+      FW__Run run = lane->runs[lane->run_first];
+      run.end = size + event_size;
+      if(!fw__run_push(self, &self->batch_runs, &self->batch_run_count, &self->batch_run_capacity, &run)){
+        // the previous run stands in for it
+        if(self->batch_run_count > 0) self->batch_runs[self->batch_run_count-1].end = run.end;
+      }
+      memcpy(self->event_buffer + size, event, event_size);
+      size += event_size;
+      lane->offset += event_size;
+      if(i == 0) FW__STAT_ADD(self, events_prioritized, 1);
+    }
+    if(lane->offset == lane->size){
+      lane->offset = 0;
+      lane->size = 0;
+      lane->run_count = 0;
+      lane->run_first = 0;
+    }
+  }
+  self->event_offset = 0;
+  self->event_size = (int)size;
+}
+
+// events taken from the lanes keep the time of the read that got them
+void fw__run_time(FW* self, size_t offset){
+  while(self->batch_run+1 < self->batch_run_count && self->batch_runs[self->batch_run].end <= offset){
+    self->batch_run++;
+  }
+  self->batch_time = self->batch_runs[self->batch_run].time;
+  if(self->latency != NULL) self->read_time = self->batch_runs[self->batch_run].read_time;
+}
+
+#endif
+
+bool fw_read(FW* self){
+#if defined(__linux)
+
+  if(self->event_offset < self->event_size) return true;
+
+  if(self->lost && self->lost_wd < 0 && self->pending_size == 0){
+    // nothing would ever wake the read
+    self->error = FW_E_PATH_NOT_FOUND;
+    return false;
+  }
+
+  // drained again before every batch so new priority events overtake the
+  // queued ones, polled and released events go first
+  if(fw__lanes_size(self) > 0){
+    if(!fw__tick(self, fw__now())) return false;
+    if(self->pending_size > 0 && fw__pending_take(self)) return true;
+    fw__priority_resolve(self);
+    fw__lanes_drain(self);
+    fw__lanes_take(self);
+    return true;
+  }
+
+  if(self->poll_count > 0 || self->pending_size > 0 || self->walk_count > 0 || fw__holding(self)){
+    int ready = fw__wait(self);
+    if(ready < 0) return false;
+    if(ready == 0) return true;
+  }
+
+  // only a batch that was already queued while the caller was busy
+  // tells something about its time in the kernel queue
+  int queued = 0;
+  if(self->latency != NULL && self->return_time != 0){
+    FW__STAT_ADD(self, syscalls, 1);
+    ioctl(self->fd, FIONREAD, &queued);
+  }
+  FW__STAT_ADD(self, syscalls, 1);
+  int n = FW_READ(self->fd, self->event_buffer, sizeof(self->event_buffer));
+  if(n < 0){
+    switch(errno){
+      case EAGAIN: self->error = FW_E_NO_EVENT; break;
+      case EACCES: self->error = FW_E_ACCESS_DENIED; break;
+      case EBADF:  self->error = FW_E_UNKNOWN; break;
+      case EFAULT: self->error = FW_E_BAD_STATE; break;
+      case EINTR:  self->error = FW_E_NO_EVENT; break;
+      case EINVAL: self->error = FW_E_BAD_STATE; break;
+      case EIO:    self->error = FW_E_IO_ERROR; break;
+      default:     self->error = FW_E_UNKNOWN; break;
+    }
+    return false;
+  }
+  fw__clear_private(self->event_buffer, n);
+  self->event_offset = 0;
+  self->event_size = n;
+  FW_TRACE(read, self->fd, n);
+  FW__STAT_ADD(self, reads, 1);
+  FW__STAT_ADD(self, bytes_read, n);
+  if((uint64_t)n > self->stats.buffer_high_water){
+    FW__STAT_SET(self, buffer_high_water, n);
+  }
+  self->batch_time = fw__batch_now(self);
+  if(self->latency != NULL){
+    self->read_time = (self->flags & FW_COARSE_TIME) ? fw__now() : self->batch_time;
+    if(queued > 0){
+      fw__histogram_record(&self->latency->kernel_to_read, self->return_time, self->read_time);
+    }
+  }
+  self->batch_run_count = 0;
+  if(self->priority_count > 0){
+    FW__Run read;
+    read.end = 0;
+    read.time = self->batch_time;
+    read.read_time = self->read_time;
+    fw__priority_resolve(self);
+    fw__lanes_split(self, self->event_buffer, n, &read);
+    fw__lanes_drain(self);
+    fw__lanes_take(self);
+  }
+  return true;
+
+#elif defined(__WIN32)
+
+  if(self->event != NULL) return true;
+
+  DWORD ret = ReadDirectoryChangesW(
+      self->handle,
+      self->event_buffer,
+      sizeof(self->event_buffer),
+      TRUE,
+      FILE_NOTIFY_CHANGE_FILE_NAME
+      | FILE_NOTIFY_CHANGE_DIR_NAME
+      | FILE_NOTIFY_CHANGE_LAST_WRITE,
+      NULL,
+      &self->event_info,
+      NULL);
+    
+  if(ret == 0){
+    self->error = FW_E_UNKNOWN;
+    return false;
+  }
+
+  ret = WaitForSingleObject(self->event_info.hEvent, INFINITE);
+  if(ret != WAIT_OBJECT_0){
+    switch(ret){
+      case WAIT_ABANDONED:
+      case WAIT_TIMEOUT: self->error = FW_E_NO_EVENT; break;
+      default: self->error = FW_E_UNKNOWN; break;
+    }
+    return false;
+  }
+  self->batch_time = fw__batch_now(self);
+  if(self->latency != NULL){
+    self->read_time = (self->flags & FW_COARSE_TIME) ? fw__now() : self->batch_time;
+  }
+
+  DWORD bytes = 0;
+  GetOverlappedResult(self->handle, &self->event_info, &bytes, FALSE);
+  FW_TRACE(read, 0, bytes);
+  FW__STAT_ADD(self, reads, 1);
+  FW__STAT_ADD(self, bytes_read, bytes);
+  if(bytes == 0){
+    // the buffer overflowed and the changes were dropped
+    FW__STAT_ADD(self, overflows, 1);
+    return true;
+  }
+  if((uint64_t)bytes > self->stats.buffer_high_water){
+    FW__STAT_SET(self, buffer_high_water, bytes);
+  }
+  self->event = (FILE_NOTIFY_INFORMATION*)self->event_buffer;
+  return true;
+#endif
+}
+
+// watches the file again after it was replaced, moved away or deleted,
+// returns the event that describes the change or 0 if there was none,
+// FW_ROOT_LOST when its directory is gone too
+FW_Event fw__file_rearm(FW* self){
+  char path[FW_PATH_MAX];
+  if(fw__watch_path(self, 0, self->file_name, path, sizeof(path)) >= sizeof(path)) return (FW_Event)0;
+
+  int old_wd = self->wd;
+  bool missing = false;
+  while(true){
+    struct stat st;
+    if(fw__stat(self, path, &st) == 0 && !S_ISDIR(st.st_mode)){
+      if(!missing && st.st_ino == self->file_inode && st.st_dev == self->file_device){
+        // only its attributes or another link changed
+        if(self->wd >= 0) return (FW_Event)0;
+      }
+      int wd = fw__add_watch(self, path, fw__inotify_mask(self));
+      if(wd >= 0){
+        if(old_wd >= 0 && old_wd != wd) fw__rm_watch(self, old_wd);
+        if(self->file_parent_wd >= 0) fw__rm_watch(self, self->file_parent_wd);
+        self->file_parent_wd = -1;
+        fw__watch_map_remove(self, self->watches[0].wd);
+        self->watches[0].wd = wd;
+        fw__watch_map_insert(self, 0);
+        fw__rewrite_wd(self, self->wd, wd);
+        self->wd = wd;
+        self->file_inode = st.st_ino;
+        self->file_device = st.st_dev;
+        return missing ? FW_CREATE : FW_MODIFY;
+      }
+    }
+    if(missing || self->file_parent_wd >= 0) break;
+
+    // wait for it on its directory, which is checked once more since the
+    // file may have appeared before the watch was added
+    if(old_wd >= 0) fw__rm_watch(self, old_wd);
+    old_wd = -1;
+    self->wd = -1;
+    char dir[FW_PATH_MAX];
+    fw__watch_path(self, 0, NULL, dir, sizeof(dir));
+    self->file_parent_wd = fw__add_watch(self, dir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | fw__inotify_flags(self));
+    if(self->file_parent_wd < 0) return FW_ROOT_LOST;
+    missing = true;
+  }
+  return FW_DELETE;
+}
+
+// watches the root again once its path is a directory again
+bool fw__root_rearm(FW* self, const char* path){
+  struct stat st;
+  if(fw__stat(self, path, &st) < 0 || !S_ISDIR(st.st_mode)) return false;
+  if(self->file_name != NULL){
+    // watches the file or waits for it in the directory
+    fw__file_rearm(self);
+    return self->wd >= 0 || self->file_parent_wd >= 0;
+  }
+  int wd = fw__add_watch(self, path, fw__inotify_mask(self) | IN_MOVE_SELF | IN_ONLYDIR);
+  if(wd < 0) return false;
+  fw__watch_map_remove(self, self->watches[0].wd);
+  self->watches[0].wd = wd;
+  fw__watch_map_insert(self, 0);
+  self->wd = wd;
+  // a failure leaves parts of the tree unwatched, like at init
+  if(self->flags & FW_RECURSIVE) fw__watch_tree(self, 0, -1);
+  return true;
+}
+
+// watches the deepest existing directory on the way to the lost root, or
+// the root itself when it is back
+void fw__lost_watch(FW* self){
+  if(self->lost_wd >= 0) fw__rm_watch(self, self->lost_wd);
+  self->lost_wd = -1;
+  char path[FW_PATH_MAX];
+  size_t len = fw__watch_path(self, 0, NULL, path, sizeof(path));
+  if(len >= sizeof(path)) return;
+
+  // retried while the path grows back between the checks
+  for(int retry = 0; retry < 64; ++retry){
+    if(fw__root_rearm(self, path)){
+      self->lost = false;
+      fw__pending_push(self, self->wd, FW__IN_ROOT, "", 0);
+      return;
+    }
+    size_t end = len;
+    int wd = -1;
+    char dir[FW_PATH_MAX];
+    while(true){
+      while(end > 0 && path[end-1] != '/') end--;
+      size_t dir_len = end > 1 ? end - 1 : end;
+      if(dir_len == 0){
+        memcpy(dir, ".", 2);
+      }else{
+        memcpy(dir, path, dir_len);
+        dir[dir_len] = '\0';
+      }
+      wd = fw__add_watch(self, dir, IN_CREATE | IN_MOVED_TO | IN_MOVE_SELF | IN_DELETE_SELF | IN_ONLYDIR | fw__inotify_flags(self));
+      if(wd >= 0 || end <= 1) break;
+      end--;
+    }
+    if(wd < 0) return;
+    self->lost_wd = wd;
+    self->lost_len = end;
+
+    // the next directory may have been created before the watch was added
+    size_t next = end;
+    while(next < len && path[next] != '/') next++;
+    memcpy(dir, path, next);
+    dir[next] = '\0';
+    struct stat st;
+    FW__STAT_ADD(self, syscalls, 1);
+    if(stat(dir, &st) < 0) return;
+    fw__rm_watch(self, wd);
+    self->lost_wd = -1;
+  }
+}
+
+// follows the path to the lost root down or back up
+void fw__lost_change(FW* self, const struct inotify_event* event){
+  if(event->mask & IN_IGNORED){
+    self->lost_wd = -1;
+  }else if(!(event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))){
+    char path[FW_PATH_MAX];
+    size_t len = fw__watch_path(self, 0, NULL, path, sizeof(path));
+    size_t next = self->lost_len;
+    while(next < len && path[next] != '/') next++;
+    size_t name_len = next - self->lost_len;
+    if(event->len == 0
+        || strlen(event->name) != name_len
+        || memcmp(event->name, path + self->lost_len, name_len) != 0){
+      return;
+    }
+  }
+  fw__lost_watch(self);
+}
+
+// drops the whole tree once the root is gone or no longer at its path
+void fw__root_lost(FW* self){
+  while(self->watches[0].child >= 0 && fw__watch_drop(self, self->watches[0].child, false));
+  if(self->wd >= 0) fw__rm_watch(self, self->wd);
+  if(self->file_parent_wd >= 0) fw__rm_watch(self, self->file_parent_wd);
+  self->wd = -1;
+  self->file_parent_wd = -1;
+  self->lost = true;
+  if(self->flags & FW_REARM) fw__lost_watch(self);
+}
+
+// the event of a watched file, 0 if it is not delivered
+FW_Event fw__file_event(FW* self, const struct inotify_event* event){
+  if(event->wd == self->file_parent_wd){
+    if(event->mask & IN_IGNORED){
+      // the directory is gone as well
+      self->file_parent_wd = -1;
+      fw__root_lost(self);
+      return FW_ROOT_LOST;
+    }
+    if(event->len == 0 || strcmp(event->name, self->file_name) != 0) return (FW_Event)0;
+    return fw__file_rearm(self) == FW_DELETE ? (FW_Event)0 : FW_CREATE;
+  }
+  if(event->wd != self->wd) return (FW_Event)0;
+  if(event->mask & IN_MODIFY) return FW_MODIFY;
+  FW_Event type = fw__file_rearm(self);
+  if(type == FW_ROOT_LOST){
+    // reported after the file itself
+    fw__pending_push(self, self->watches[0].wd, FW__IN_ROOT | IN_IGNORED, "", 0);
+    type = FW_DELETE;
+  }
+  return type;
+}
+
+// the event of the watched path itself, 0 if it is not delivered
+FW_Event fw__root_event(FW* self, const struct inotify_event* event){
+  if(event->mask & FW__IN_ROOT){
+    if(!(event->mask & IN_IGNORED)) return FW_ROOT_BACK;
+    fw__root_lost(self);
+    return FW_ROOT_LOST;
+  }
+  if(self->lost_wd >= 0 && event->wd == self->lost_wd){
+    fw__lost_change(self, event);
+    return (FW_Event)0;
+  }
+  if(self->file_name != NULL) return fw__file_event(self, event);
+  fw__root_lost(self);
+  return FW_ROOT_LOST;
+}
+
+bool fw_next(FW* self, FW_Record* record){
+#if defined(__linux)
+
+  while(self->event_offset < self->event_size){
+    struct inotify_event* event = (struct inotify_event*)(self->event_buffer + self->event_offset);
+    if(self->batch_run_count > 0) fw__run_time(self, self->event_offset);
+    self->event_offset += sizeof(*event) + event->len;
+    FW_TRACE(consume, event->wd, self->event_size - self->event_offset);
+    // already delivered as the second half of a rename
+    if(event->mask == 0) continue;
+
+    if(event->mask & FW__IN_RELEASED){
+      event->mask &= ~FW__IN_RELEASED;
+    }else if((self->watch_events & FW_DELETE_TREE) && (self->flags & FW_RECURSIVE)){
+      if((event->mask & (IN_DELETE | IN_IGNORED)) && fw__hold(self, event)) continue;
+      if(fw__holding(self)){
+        // anything else ends the run, which goes first
+        fw__release(self, self->event_offset - (int)(sizeof(*event) + event->len));
+        fw__pending_take(self);
+        continue;
+      }
+    }
+
+    fw__parsed(self);
+    FW_TRACE(parse, event->wd, event->mask, event->len > 0 ? event->name : "");
+    if(event->mask & IN_Q_OVERFLOW){
+      FW__STAT_ADD(self, overflows, 1);
+      FW__STAT_ADD(self, events_filtered, 1);
+      continue;
+    }
+    // about the watched path itself rather than something in it
+    bool root = self->file_name != NULL
+      || (event->mask & FW__IN_ROOT)
+      || (self->lost_wd >= 0 && event->wd == self->lost_wd)
+      || (event->wd == self->wd && (event->mask & (IN_IGNORED | IN_MOVE_SELF | IN_UNMOUNT)));
+    if(root){
+      FW_Event type = fw__root_event(self, event);
+      if(!(self->watch_events & type)){
+        FW__STAT_ADD(self, events_filtered, 1);
+        continue;
+      }
+      record->event = type;
+      record->name = self->file_name != NULL ? self->file_name : "";
+      record->name_len = self->file_name_len;
+      record->dir = self->watches[0].wd;
+      record->new_name = "";
+      record->new_name_len = 0;
+      record->new_dir = -1;
+      return fw__deliver(self, record);
+    }
+    if(event->mask & IN_IGNORED){
+      // watch removed by the kernel, the directory is gone
+      int index = fw__watch_find(self, event->wd);
+      if(index > 0) fw__watch_drop(self, index, true);
+      FW__STAT_ADD(self, events_filtered, 1);
+      continue;
+    }
+    if((self->flags & FW_RECURSIVE)
+        && (event->mask & IN_ISDIR)
+        && (event->mask & (IN_CREATE | IN_MOVED_TO))){
+      fw__watch_subdir(self, event);
+    }
+    if((self->flags & FW_RECURSIVE)
+        && (event->mask & IN_ISDIR)
+        && (event->mask & IN_MOVED_FROM)
+        && fw__find_moved_to(self, event->cookie) == NULL){
+      // moved out of the tree, or the new name is in the next batch and
+      // is walked again from there
+      fw__watch_moved_out(self, event);
+    }
+
+    FW_Event type = (FW_Event)0;
+    switch(event->mask & ~IN_ISDIR){
+      case IN_DELETE | FW__IN_TREE: type = FW_DELETE_TREE; break;
+      case IN_CREATE: type = FW_CREATE; break;
+      case IN_DELETE: type = FW_DELETE; break;
+      case IN_MODIFY: type = FW_MODIFY; break;
+      case IN_MOVED_FROM: type = FW_RENAME; break;
+      case IN_MOVED_TO: type = FW_RENAME; break;
+      default: break;
+    }
+    if(!(self->watch_events & type)){
+      // the moves may only be subscribed to follow directories
+      FW__STAT_ADD(self, events_filtered, 1);
+      continue;
+    }
+
+    const char* name = event->len > 0 ? event->name : "";
+    record->event = type;
+    record->name = name;
+    record->name_len = strlen(name);
+    record->dir = event->wd;
+    record->new_name = "";
+    record->new_name_len = 0;
+    record->new_dir = -1;
+
+    if(event->mask & IN_MOVED_FROM){
+      struct inotify_event* to = fw__find_moved_to(self, event->cookie);
+      if(to != NULL){
+        FW__STAT_ADD(self, events_parsed, 1);
+        FW_TRACE(parse, to->wd, to->mask, to->name);
+        if((self->flags & FW_RECURSIVE) && (to->mask & IN_ISDIR)){
+          fw__watch_rename(self, event, to);
+        }
+        record->new_name = to->name;
+        record->new_name_len = strlen(to->name);
+        record->new_dir = to->wd;
+        to->mask = 0;
+      }
+      // otherwise it was moved out of the tree or the
+      // new name is not in this batch
+    }else if(event->mask & IN_MOVED_TO){
+      // moved in from outside of the tree
+      record->new_name = record->name;
+      record->new_name_len = record->name_len;
+      record->new_dir = record->dir;
+      record->name = "";
+      record->name_len = 0;
+      record->dir = -1;
+    }
+    if(self->poll_count > 0) fw__touch(self, event->wd);
+    if(fw__filtered(self, record)) continue;
+    return fw__deliver(self, record);
+  }
+  return false;
+
+#elif defined(__WIN32)
+
+  while(self->event != NULL){
+    FILE_NOTIFY_INFORMATION* event = fw__pop_event(self);
+    fw__parsed(self);
+    FW_TRACE(parse, 0, event->Action, "");
+
+    FW_Event type = (FW_Event)0;
+    switch(event->Action){
+      case FILE_ACTION_ADDED: type = FW_CREATE; break;
+      case FILE_ACTION_REMOVED: type = FW_DELETE; break;
+      case FILE_ACTION_MODIFIED: type = FW_MODIFY; break;
+      case FILE_ACTION_RENAMED_OLD_NAME: type = FW_RENAME; break;
+      case FILE_ACTION_RENAMED_NEW_NAME: type = FW_RENAME; break;
+      default: break;
+    }
+    if(!(self->watch_events & type)){
+      FW__STAT_ADD(self, events_filtered, 1);
+      continue;
+    }
+
+    record->event = type;
+    record->name = fw__narrow_name(event, &record->name_len);
+    record->dir = 0;
+    record->new_name = "";
+    record->new_name_len = 0;
+    record->new_dir = 0;
+
+    if(event->Action == FILE_ACTION_RENAMED_OLD_NAME){
+      if(self->event != NULL && self->event->Action == FILE_ACTION_RENAMED_NEW_NAME){
+        FW__STAT_ADD(self, events_parsed, 1);
+        record->new_name = fw__narrow_name(fw__pop_event(self), &record->new_name_len);
+      }
+    }else if(event->Action == FILE_ACTION_RENAMED_NEW_NAME){
+      record->new_name = record->name;
+      record->new_name_len = record->name_len;
+      record->name = "";
+      record->name_len = 0;
+    }
+    if(fw__filtered(self, record)) continue;
+    return fw__deliver(self, record);
+  }
+  return false;
+#endif
+}
+
+// copies a record into the context for the event data getters
+void fw__keep(FW* self, const FW_Record* record){
+  self->received_events = record->event;
+  self->event_time = record->time;
+  memcpy(self->name, record->name, record->name_len);
+  memcpy(self->new_name, record->new_name, record->new_name_len);
+  self->name[record->name_len] = '\0';
+  self->new_name[record->new_name_len] = '\0';
+#if defined(__linux)
+  self->event_wd = record->dir;
+  self->new_event_wd = record->new_dir;
+#endif
+}
+
+bool fw__watch(FW* self){
+  if(self->watch_events == 0){
+    self->error = FW_E_NO_EVENT;
+    return false;
+  }
+
+  self->received_events = (FW_Event)0;
+  memset(self->name, 0, sizeof(self->name));
+  memset(self->new_name, 0, sizeof(self->new_name));
+
+  FW_Record record;
+  while(!fw_next(self, &record)){
+    if(!fw_read(self)) return false;
+  }
+  fw__keep(self, &record);
+  return true;
+}
+
+bool fw_watch(FW* self){
+  bool ok = fw__watch(self);
+  if(self->latency != NULL){
+    self->return_time = fw__now();
+    if(ok){
+      fw__histogram_record(&self->latency->parse_to_delivery, self->parse_time, self->return_time);
+    }
+  }
+  return ok;
+}
+
+FW_Stats fw_stats(FW* self){
+  FW_Stats stats;
+  stats.reads = __atomic_load_n(&self->stats.reads, __ATOMIC_RELAXED);
+  stats.bytes_read = __atomic_load_n(&self->stats.bytes_read, __ATOMIC_RELAXED);
+  stats.syscalls = __atomic_load_n(&self->stats.syscalls, __ATOMIC_RELAXED);
+  stats.events_parsed = __atomic_load_n(&self->stats.events_parsed, __ATOMIC_RELAXED);
+  stats.events_filtered = __atomic_load_n(&self->stats.events_filtered, __ATOMIC_RELAXED);
+  stats.events_delivered = __atomic_load_n(&self->stats.events_delivered, __ATOMIC_RELAXED);
+  stats.overflows = __atomic_load_n(&self->stats.overflows, __ATOMIC_RELAXED);
+  stats.incomplete_renames = __atomic_load_n(&self->stats.incomplete_renames, __ATOMIC_RELAXED);
+  stats.buffer_high_water = __atomic_load_n(&self->stats.buffer_high_water, __ATOMIC_RELAXED);
+  stats.watches = __atomic_load_n(&self->stats.watches, __ATOMIC_RELAXED);
+  stats.polls = __atomic_load_n(&self->stats.polls, __ATOMIC_RELAXED);
+  stats.promotions = __atomic_load_n(&self->stats.promotions, __ATOMIC_RELAXED);
+  stats.demotions = __atomic_load_n(&self->stats.demotions, __ATOMIC_RELAXED);
+  stats.inventory_hits = __atomic_load_n(&self->stats.inventory_hits, __ATOMIC_RELAXED);
+  stats.directory_moves = __atomic_load_n(&self->stats.directory_moves, __ATOMIC_RELAXED);
+  stats.deletes_collapsed = __atomic_load_n(&self->stats.deletes_collapsed, __ATOMIC_RELAXED);
+  stats.events_prioritized = __atomic_load_n(&self->stats.events_prioritized, __ATOMIC_RELAXED);
+  return stats;
+}
+
+const FW_Latency* fw_latency(FW* self){
+  return self->latency;
+}
+
+uint64_t fw_histogram_percentile(const FW_Histogram* histogram, double percentile){
+  if(histogram->count == 0) return 0;
+  uint64_t rank = (uint64_t)(percentile/100.0*histogram->count);
+  if(rank >= histogram->count) return histogram->max;
+  uint64_t seen = 0;
+  for(size_t i = 0; i < FW_HISTOGRAM_BUCKETS; ++i){
+    seen += histogram->buckets[i];
+    if(seen > rank){
+      uint64_t value = fw__histogram_value(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+const char* fw_strerror(FW_Error error){
+  switch (error) {
+    case FW_E_IO_ERROR: return "Platform IO error"; 
+    case FW_E_PLATFORM_LIMIT: return "A platform limitiation has been reached"; 
+    case FW_E_ACCESS_DENIED: return "Access to file/direcoty has been denied"; 
+    case FW_E_BAD_STATE: return "FW is in bad state"; 
+    case FW_E_INVALID_ARGUMENT: return "An invalid argument was provided"; 
+    case FW_E_NO_EVENT: return "No event was available"; 
+    case FW_E_PATH_NOT_FOUND: return "Path not found"; 
+    case FW_E_PATH_TOO_LONG: return "Path is too long"; 
+    case FW_E_UNKNOWN: return "An unknown error occured"; 
+    case FW_E_INCOMPLETE_EVENT: return "An incomplete (FW_RENAME) event was received"; 
+    case FW_E_MEMORY_BUDGET: return "The memory budget has been exceeded"; 
+  }
+  return "Invalid error code provided to fw_strerror";
+}
+
+FW_Error fw_error(FW* self){
+  return self->error;
+}
+
+int fw_fd(FW* self){
+#if defined(__linux)
+  return self->fd;
+#elif defined(__WIN32)
+  (void)self;
+  return -1;
+#endif
+}
+
+FW_Event fw_event(FW* self){
+  return self->received_events;
+}
+
+uint64_t fw_time(FW* self){
+  return self->event_time;
+}
+
+const char* fw_name(FW* self){
+  return self->name;
+}
+
+const char* fw_new_name(FW* self){
+  return self->new_name;
+}
+
+FW_MemoryUsage fw_memory_usage(FW* self){
+  FW_MemoryUsage usage;
+  memset(&usage, 0, sizeof(usage));
+#if defined(__linux)
+  usage.bytes = fw__memory_used(self);
+  usage.watches = self->watch_count;
+  if(usage.watches > 0) usage.bytes_per_watch = usage.bytes/usage.watches;
+#elif defined(__WIN32)
+  // a single handle watches the whole tree
+  (void)self;
+#endif
+  return usage;
+}
+
+FW_Coverage fw_coverage(FW* self){
+  FW_Coverage coverage;
+  memset(&coverage, 0, sizeof(coverage));
+#if defined(__linux)
+  coverage.directories = self->watch_count;
+  coverage.watched = fw__watched(self);
+  coverage.polled = self->poll_count;
+  coverage.watch_limit = self->watch_limit;
+  for(size_t i = 0; i < self->walk_count; ++i){
+    if(self->walks[i].index >= 0) coverage.pending++;
+  }
+#elif defined(__WIN32)
+  (void)self;
+#endif
+  return coverage;
+}
+
+bool fw_ready(FW* self, const char* path){
+#if defined(__linux)
+  // find the directory by following the components from the root, which
+  // is the first watch and stays in place while its path is lost
+  int index = 0;
+  const FW__Name* root = fw__name(self, self->watches[index].name);
+  const char* root_str = fw__name_str(self, self->watches[index].name);
+  // only whole components, "/x/ab" is not below "/x/a"
+  if(strncmp(path, root_str, root->len) == 0
+      && (path[root->len] == '/' || path[root->len] == '\0'
+        || (root->len > 0 && root_str[root->len-1] == '/'))){
+    path += root->len;
+  }
+  while(*path != '\0'){
+    while(*path == '/') path++;
+    size_t len = strcspn(path, "/");
+    if(len == 0 || (len == 1 && path[0] == '.')){
+      path += len;
+      continue;
+    }
+    int child = fw__watch_child(self, index, path, len);
+    // not registered yet, or not a directory of the tree at all
+    if(child < 0) return false;
+    index = child;
+    path += len;
+  }
+  for(size_t i = 0; i < self->walk_count; ++i){
+    for(int walk = self->walks[i].index; walk >= 0; walk = self->watches[walk].parent){
+      if(walk == index) return false;
+    }
+  }
+  return true;
+#elif defined(__WIN32)
+  // a single handle covers the whole tree from the start
+  (void)self;
+  (void)path;
+  return true;
+#endif
+}
+
+bool fw_inventory_save(FW* self, const char* path){
+#if defined(__linux)
+  int root = fw__watch_find(self, self->wd);
+  // a tree that was never walked completely would only hide directories
+  if(root < 0 || !self->walked){
+    self->error = FW_E_BAD_STATE;
+    return false;
+  }
+  // children of every watch through counting sort on the parent, then the
+  // breadth first order that keeps them contiguous
+  size_t capacity = self->watch_capacity;
+  uint32_t* start = (uint32_t*)FW_REALLOC(NULL, sizeof(*start)*(capacity+1));
+  int* children = (int*)FW_REALLOC(NULL, sizeof(*children)*capacity);
+  int* order = (int*)FW_REALLOC(NULL, sizeof(*order)*capacity);
+  FW__InventoryRecord* records = (FW__InventoryRecord*)FW_REALLOC(NULL, sizeof(*records)*capacity);
+  bool ok = start != NULL && children != NULL && order != NULL && records != NULL;
+  if(!ok) self->error = FW_E_PLATFORM_LIMIT;
+
+  size_t count = 0;
+  uint64_t names_size = 0;
+  if(ok){
+    memset(start, 0, sizeof(*start)*(capacity+1));
+    for(size_t i = 0; i < capacity; ++i){
+      if(self->watches[i].wd != -1 && self->watches[i].parent >= 0) start[self->watches[i].parent+1]++;
+    }
+    for(size_t i = 0; i < capacity; ++i) start[i+1] += start[i];
+    for(size_t i = 0; i < capacity; ++i){
+      int parent = self->watches[i].parent;
+      if(self->watches[i].wd != -1 && parent >= 0) children[start[parent]++] = i;
+    }
+    // start[i] now points at the end of the children of i
+    order[count++] = root;
+    for(size_t head = 0; head < count; ++head){
+      int index = order[head];
+      uint32_t first = index > 0 ? start[index-1] : 0;
+      FW__InventoryRecord* record = &records[head];
+      const FW__Stamp* stamp = (size_t)index < self->stamp_capacity ? &self->stamps[index] : NULL;
+      record->inode = stamp != NULL ? stamp->inode : 0;
+      record->ctime = stamp != NULL ? stamp->ctime : 0;
+      record->name = names_size;
+      record->name_len = index == root ? 0 : fw__name(self, self->watches[index].name)->len;
+      record->first_child = count;
+      record->child_count = start[index] - first;
+      names_size += record->name_len;
+      for(uint32_t i = first; i < start[index]; ++i) order[count++] = children[i];
+    }
+  }
+
+  char tmp[FW_PATH_MAX];
+  int fd = -1;
+  if(ok && (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)){
+    self->error = FW_E_PATH_TOO_LONG;
+    ok = false;
+  }
+  if(ok){
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+      self->error = errno == EACCES ? FW_E_ACCESS_DENIED : FW_E_IO_ERROR;
+      ok = false;
+    }
+  }
+  if(ok){
+    const FW__Name* root_name = fw__name(self, self->watches[root].name);
+    FW__InventoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "FWI1", 4);
+    header.version = 1;
+    header.record_count = count;
+    header.names_size = names_size;
+    header.root_len = root_name->len;
+    // the names go through a small buffer to keep the writes few
+    char buf[65536];
+    size_t used = 0;
+    const char padding[8] = {0};
+    const char* parts[4] = {(const char*)&header, fw__name_str(self, self->watches[root].name), padding, (const char*)records};
+    size_t sizes[4] = {sizeof(header), root_name->len, fw__inventory_pad(root_name->len) - root_name->len, count*sizeof(*records)};
+    for(int i = 0; ok && i < 4; ++i){
+      ok = write(fd, parts[i], sizes[i]) == (ssize_t)sizes[i];
+    }
+    for(size_t i = 1; ok && i <= count; ++i){
+      size_t len = i < count ? records[i].name_len : 0;
+      if(i == count || used + len > sizeof(buf)){
+        ok = write(fd, buf, used) == (ssize_t)used;
+        used = 0;
+      }
+      if(i < count){
+        memcpy(buf + used, fw__name_str(self, self->watches[order[i]].name), len);
+        used += len;
+      }
+    }
+    if(!ok) self->error = FW_E_IO_ERROR;
+    close(fd);
+    // replaced at once so a crash never leaves half an inventory behind
+    if(ok && rename(tmp, path) < 0){
+      self->error = FW_E_IO_ERROR;
+      ok = false;
+    }
+    if(!ok) unlink(tmp);
+  }
+  FW_FREE(start);
+  FW_FREE(children);
+  FW_FREE(order);
+  FW_FREE(records);
+  return ok;
+#elif defined(__WIN32)
+  // a single handle watches the whole tree without walking it
+  (void)self;
+  (void)path;
+  return true;
+#endif
+}
+
+int fw_timeout(FW* self){
+#if defined(__linux)
+  if(self->event_offset < self->event_size || self->pending_size > 0 || self->walk_count > 0) return 0;
+  if(fw__lanes_size(self) > 0) return 0;
+  if(self->poll_count == 0 && !fw__holding(self)) return -1;
+  uint64_t deadline = UINT64_MAX;
+  if(self->poll_count > 0) deadline = self->poll_deadline;
+  if(fw__holding(self) && self->hold_deadline < deadline) deadline = self->hold_deadline;
+  uint64_t now = fw__now();
+  if(now >= deadline) return 0;
+  return (int)((deadline - now + 999999)/1000000);
+#elif defined(__WIN32)
+  (void)self;
+  return -1;
+#endif
+}
+
+size_t fw__path(FW* self, const char* name, int wd, char* buf, size_t size){
+#if defined(__linux)
+  int index = fw__watch_find(self, wd);
+  if(index < 0){
+    if(size > 0) buf[0] = '\0';
+    return 0;
+  }
+  return fw__watch_path(self, index, name, buf, size);
+#elif defined(__WIN32)
+  (void)wd;
+  int len = snprintf(buf, size, "%s\\%s", self->root, name);
+  return len < 0 ? 0 : (size_t)len;
+#endif
+}
+
+size_t fw_record_path(FW* self, const FW_Record* record, char* buf, size_t size){
+  return fw__path(self, record->name, record->dir, buf, size);
+}
+
+size_t fw_record_new_path(FW* self, const FW_Record* record, char* buf, size_t size){
+  return fw__path(self, record->new_name, record->new_dir, buf, size);
+}
+
+size_t fw_path(FW* self, char* buf, size_t size){
+#if defined(__linux)
+  return fw__path(self, self->name, self->event_wd, buf, size);
+#elif defined(__WIN32)
+  return fw__path(self, self->name, 0, buf, size);
+#endif
+}
+
+size_t fw_new_path(FW* self, char* buf, size_t size){
+#if defined(__linux)
+  return fw__path(self, self->new_name, self->new_event_wd, buf, size);
+#elif defined(__WIN32)
+  return fw__path(self, self->new_name, 0, buf, size);
+#endif
+}
+
+bool fw_once(FW* self, const char* path, FW_Event events){
+  if(!fw_init(self, path, events)){
+    return false;
+  }
+  if(!fw_watch(self)){
+    return false;
+  }
+  fw_deinit(self);
+  return true;
+}
+
+#if defined(__linux)
+// gives the watches up to end the mask of the watched events, returns the
+// index of the watch that failed or end, IN_MASK_ADD is left out since it
+// would only ever widen the mask
+size_t fw__remask(FW* self, uint32_t mask, size_t end){
+  mask &= ~IN_MASK_ADD;
+  char path[FW_PATH_MAX];
+  for(size_t i = 0; i < end; ++i){
+    int wd = self->watches[i].wd;
+    if(wd < 0) continue;
+    uint32_t in_events = mask | IN_ONLYDIR;
+    if(i == 0){
+      if(wd != self->wd) continue; // the root or file is lost
+      in_events = self->file_name != NULL ? mask : mask | IN_MOVE_SELF;
+      if(self->flags & FW_ONLYDIR) in_events |= IN_ONLYDIR;
+    }
+    if(fw__watch_path(self, (int)i, i == 0 ? self->file_name : NULL, path, sizeof(path)) >= sizeof(path)){
+      continue;
+    }
+    int new_wd = fw__add_watch(self, path, in_events);
+    if(new_wd < 0){
+      // gone already, its IN_IGNORED is on the way
+      if(errno == ENOENT || errno == ENOTDIR) continue;
+      fw__add_watch_error(self);
+      return i;
+    }else if(new_wd != wd && fw__watch_find(self, new_wd) < 0){
+      // another directory took its place, it is followed through its events
+      fw__rm_watch(self, new_wd);
+    }
+  }
+  return end;
+}
+#endif
+
+bool fw_set_events(FW* self, FW_Event events){
+#if defined(__linux)
+  FW_Event old_events = self->watch_events;
+  uint32_t old_mask = fw__inotify_mask(self);
+  self->watch_events = events;
+  uint32_t mask = fw__inotify_mask(self);
+
+  // same path, same inode, so the kernel replaces the mask of the watch in
+  // place and keeps its queued events
+  if(mask != old_mask){
+    size_t failed = fw__remask(self, mask, self->watch_capacity);
+    if(failed < self->watch_capacity){
+      // the watches changed so far get their old mask back
+      FW_Error error = self->error;
+      fw__remask(self, old_mask, failed);
+      self->error = error;
+      self->watch_events = old_events;
+      return false;
+    }
+  }
+  // deletions held back are delivered as they are when no longer collapsed
+  if(fw__holding(self) && !(events & FW_DELETE_TREE)) fw__release(self, self->event_offset);
+  return true;
+#elif defined(__WIN32)
+  // the notify filter always covers every event
+  self->watch_events = events;
+  return true;
+#endif
+}
+
+#if defined(__linux)
+bool fw_wait_pool_init(FW_WaitPool* self, size_t capacity){
+  memset(self, 0, sizeof(*self));
+  if(capacity == 0){
+    self->error = FW_E_INVALID_ARGUMENT;
+    return false;
+  }
+  // allocated once and never compacted, the context returned by
+  // fw_wait_for stays at its slot until that waiter is dropped
+  self->waiters = (FW__Waiter*)FW_REALLOC(NULL, capacity*sizeof(*self->waiters));
+  if(self->waiters == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
+    return false;
+  }
+  memset(self->waiters, 0, capacity*sizeof(*self->waiters));
+  self->capacity = capacity;
+  return true;
+}
+
+void fw__waiter_drop(FW_WaitPool* self, FW__Waiter* waiter){
+  fw_deinit(&waiter->fw);
+  FW_FREE(waiter->path);
+  waiter->path = NULL;
+  self->waiter_count--;
+}
+
+void fw_wait_pool_deinit(FW_WaitPool* self){
+  for(size_t i = 0; i < self->capacity; ++i){
+    if(self->waiters[i].path != NULL) fw__waiter_drop(self, &self->waiters[i]);
+  }
+  FW_FREE(self->waiters);
+  self->waiters = NULL;
+  self->capacity = 0;
+}
+
+// the armed watcher of path covering events, set up on first use and taking
+// the slot of the least recently used one when the pool is full
+FW__Waiter* fw__waiter(FW_WaitPool* self, const char* path, FW_Event events){
+  FW__Waiter* waiter = NULL;
+  FW__Waiter* free_slot = NULL;
+  FW__Waiter* oldest = NULL;
+  for(size_t i = 0; i < self->capacity; ++i){
+    FW__Waiter* slot = &self->waiters[i];
+    if(slot->path == NULL){
+      if(free_slot == NULL) free_slot = slot;
+    }else if(strcmp(slot->path, path) == 0){
+      waiter = slot;
+      break;
+    }else if(oldest == NULL || slot->used < oldest->used){
+      oldest = slot;
+    }
+  }
+
+  if(waiter != NULL){
+    if((waiter->events & events) == events) return waiter;
+    // widened in place so the events queued until now are kept
+    events = (FW_Event)(events | waiter->events);
+    if(!fw_set_events(&waiter->fw, events)){
+      self->error = fw_error(&waiter->fw);
+      return NULL;
+    }
+    waiter->events = events;
+    return waiter;
+  }
+
+  if(free_slot == NULL){
+    fw__waiter_drop(self, oldest);
+    free_slot = oldest;
+  }
+  size_t len = strlen(path);
+  waiter = free_slot;
+  waiter->path = (char*)FW_REALLOC(NULL, len + 1);
+  if(waiter->path == NULL){
+    self->error = FW_E_PLATFORM_LIMIT;
+    return NULL;
+  }
+  memcpy(waiter->path, path, len + 1);
+  waiter->events = events;
+  FW_Options options;
+  memset(&options, 0, sizeof(options));
+  options.flags = FW_NONBLOCK;
+  if(!fw_init_ex(&waiter->fw, path, events, &options)){
+    self->error = fw_error(&waiter->fw);
+    FW_FREE(waiter->path);
+    waiter->path = NULL;
+    return NULL;
+  }
+  self->waiter_count++;
+  return waiter;
+}
+
+// events of path that are not among events or that the predicate rejects
+// are consumed and dropped, even when another caller waits for them on the
+// same path, such callers pass the union of their events and filter it
+FW* fw_wait_for(FW_WaitPool* self, const char* path, FW_Event events, FW_Predicate predicate, void* user, int timeout){
+  FW__Waiter* waiter = fw__waiter(self, path, events);
+  if(waiter == NULL) return NULL;
+  waiter->used = ++self->calls;
+  FW* fw = &waiter->fw;
+
+  uint64_t deadline = timeout >= 0 ? fw__now() + (uint64_t)timeout*1000000ull : UINT64_MAX;
+  while(true){
+    FW_Record record;
+    while(fw_next(fw, &record)){
+      // dropped, see above
+      if(!(record.event & events)) continue;
+      if(predicate != NULL && !predicate(fw, &record, user)) continue;
+      fw__keep(fw, &record);
+      return fw;
+    }
+    if(fw_read(fw)) continue;
+    if(fw_error(fw) != FW_E_NO_EVENT){
+      // set up again by the next call
+      self->error = fw_error(fw);
+      fw__waiter_drop(self, waiter);
+      return NULL;
+    }
+
+    uint64_t now = fw__now();
+    if(now >= deadline){
+      self->error = FW_E_NO_EVENT;
+      return NULL;
+    }
+    int wait = fw_timeout(fw);
+    if(deadline != UINT64_MAX){
+      int left = (int)((deadline - now + 999999)/1000000);
+      if(wait < 0 || left < wait) wait = left;
+    }
+    struct pollfd pfd;
+    pfd.fd = fw_fd(fw);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    FW__STAT_ADD(fw, syscalls, 1);
+    if(poll(&pfd, 1, wait) < 0 && errno != EINTR){
+      self->error = FW_E_UNKNOWN;
+      return NULL;
+    }
+  }
+}
+#endif
+
+// entry in the broadcast ring, followed by the path and new path, both
+// NUL terminated, an entry with event 0 pads the ring up to its end
+typedef struct{
+  uint32_t size;
+  uint32_t event;
+  uint64_t time;
+  uint32_t path_len;
+  uint32_t new_path_len;
+} FW__BroadcastEntry;
+
+#define FW__BROADCAST_ALIGN 8
+#define FW__BROADCAST_MAX_ENTRY (sizeof(FW__BroadcastEntry) + 2*FW_PATH_MAX + FW__BROADCAST_ALIGN)
+
+bool fw_broadcast_init(FW_Broadcast* self, size_t capacity, int subscribers){
+  memset(self, 0, sizeof(*self));
+  if(subscribers <= 0){
+    self->error = FW_E_INVALID_ARGUMENT;
+    return false;
+  }
+
+  // a full ring must still leave room for the largest event
+  size_t size = 4*FW__BROADCAST_MAX_ENTRY;
+  while(size < capacity) size *= 2;
+  self->capacity = 1;
+  while(self->capacity < size) self->capacity *= 2;
+
+  self->buffer = (char*)FW_REALLOC(NULL, self->capacity);
+  self->subscribers = (FW__Subscriber*)FW_REALLOC(NULL, subscribers*sizeof(*self->subscribers));
+  if(self->buffer == NULL || self->subscribers == NULL){
+    FW_FREE(self->buffer);
+    FW_FREE(self->subscribers);
+    self->buffer = NULL;
+    self->subscribers = NULL;
+    self->error = FW_E_PLATFORM_LIMIT;
+    return false;
+  }
+  memset(self->subscribers, 0, subscribers*sizeof(*self->subscribers));
+  self->subscriber_count = subscribers;
+  return true;
+}
+
+void fw_broadcast_deinit(FW_Broadcast* self){
+  FW_FREE(self->buffer);
+  FW_FREE(self->subscribers);
+  self->buffer = NULL;
+  self->subscribers = NULL;
+  self->subscriber_count = 0;
+}
+
+// position of the slowest subscriber, UINT64_MAX when all closed
+uint64_t fw__broadcast_gate(FW_Broadcast* self){
+  uint64_t gate = UINT64_MAX;
+  for(int i = 0; i < self->subscriber_count; ++i){
+    uint64_t cursor = __atomic_load_n(&self->subscribers[i].cursor, __ATOMIC_ACQUIRE);
+    if(cursor < gate) gate = cursor;
+  }
+  return gate;
+}
+
+void fw__broadcast_yield(void){
+#if defined(__linux)
+  sched_yield();
+#elif defined(__WIN32)
+  SwitchToThread();
+#endif
+}
+
+// claims size bytes after the head, waiting for the slowest subscriber
+// if that would overwrite an event it has not released yet
+FW__BroadcastEntry* fw__broadcast_claim(FW_Broadcast* self, uint32_t size){
+  size_t offset = self->head & (self->capacity - 1);
+  uint64_t pad = offset + size > self->capacity ? self->capacity - offset : 0;
+  uint64_t end = self->head + pad + size;
+
+  uint64_t gate = fw__broadcast_gate(self);
+  if(gate != UINT64_MAX && end - gate > self->capacity){
+    // everything written so far has to be visible or the wait never ends
+    __atomic_store_n(&self->published, self->head, __ATOMIC_RELEASE);
+    do{
+      fw__broadcast_yield();
+      gate = fw__broadcast_gate(self);
+    }while(gate != UINT64_MAX && end - gate > self->capacity);
+  }
+
+  if(pad != 0){
+    FW__BroadcastEntry* padding = (FW__BroadcastEntry*)(self->buffer + offset);
+    padding->size = (uint32_t)pad;
+    padding->event = 0;
+  }
+  FW__BroadcastEntry* entry = (FW__BroadcastEntry*)(self->buffer + ((self->head + pad) & (self->capacity - 1)));
+  self->head = end;
+  return entry;
+}
+
+// full paths of a record, truncated to FW_PATH_MAX, new_path is empty
+// unless the record is a rename
+void fw__record_paths(FW* fw, const FW_Record* record, char* path, size_t* path_len, char* new_path, size_t* new_path_len){
+  *path_len = fw_record_path(fw, record, path, FW_PATH_MAX);
+  if(*path_len >= FW_PATH_MAX) *path_len = FW_PATH_MAX - 1;
+  *new_path_len = 0;
+  new_path[0] = '\0';
+  if(record->event == FW_RENAME){
+    *new_path_len = fw_record_new_path(fw, record, new_path, FW_PATH_MAX);
+    if(*new_path_len >= FW_PATH_MAX) *new_path_len = FW_PATH_MAX - 1;
+  }
+}
+
+bool fw_broadcast_pump(FW_Broadcast* self, FW* fw){
+  if(!fw_read(fw)) return false;
+
+  char path[FW_PATH_MAX];
+  char new_path[FW_PATH_MAX];
+  FW_Record record;
+  while(fw_next(fw, &record)){
+    size_t path_len, new_path_len;
+    fw__record_paths(fw, &record, path, &path_len, new_path, &new_path_len);
+
+    size_t size = sizeof(FW__BroadcastEntry) + path_len + 1 + new_path_len + 1;
+    size = (size + FW__BROADCAST_ALIGN - 1) & ~(size_t)(FW__BROADCAST_ALIGN - 1);
+    FW__BroadcastEntry* entry = fw__broadcast_claim(self, (uint32_t)size);
+    entry->size = (uint32_t)size;
+    entry->event = record.event;
+    entry->time = record.time;
+    entry->path_len = (uint32_t)path_len;
+    entry->new_path_len = (uint32_t)new_path_len;
+    char* data = (char*)(entry + 1);
+    memcpy(data, path, path_len + 1);
+    memcpy(data + path_len + 1, new_path, new_path_len + 1);
+  }
+
+  // the whole batch becomes visible at once
+  __atomic_store_n(&self->published, self->head, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool fw_broadcast_next(FW_Broadcast* self, int subscriber, FW_BroadcastEvent* event){
+  FW__Subscriber* sub = &self->subscribers[subscriber];
+
+  // the event returned last time is no longer used
+  if(sub->cursor != sub->next){
+    __atomic_store_n(&sub->cursor, sub->next, __ATOMIC_RELEASE);
+  }
+
+  uint64_t published = __atomic_load_n(&self->published, __ATOMIC_ACQUIRE);
+  while(sub->next < published){
+    const FW__BroadcastEntry* entry = (const FW__BroadcastEntry*)(self->buffer + (sub->next & (self->capacity - 1)));
+    sub->next += entry->size;
+    if(entry->event == 0) continue;
+
+    const char* data = (const char*)(entry + 1);
+    event->event = (FW_Event)entry->event;
+    event->time = entry->time;
+    event->path = data;
+    event->path_len = entry->path_len;
+    event->new_path = data + entry->path_len + 1;
+    event->new_path_len = entry->new_path_len;
+    return true;
+  }
+  return false;
+}
+
+void fw_broadcast_close(FW_Broadcast* self, int subscriber){
+  __atomic_store_n(&self->subscribers[subscriber].cursor, UINT64_MAX, __ATOMIC_RELEASE);
+}
+
+// an event is encoded as
+//   varint zigzag(time - previous time)
+//   varint event
+//   varint path length, path
+//   varint new path length, new path (FW_RENAME only)
+size_t fw__varint_put(uint8_t* p, uint64_t value){
+  size_t n = 0;
+  while(value >= 0x80){
+    p[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  p[n++] = (uint8_t)value;
+  return n;
+}
+
+// returns the encoded length, 0 if the varint runs past end
+size_t fw__varint_get(const uint8_t* p, const uint8_t* end, uint64_t* value){
+  uint64_t result = 0;
+  for(size_t n = 0; n < 10 && p + n < end; ++n){
+    result |= (uint64_t)(p[n] & 0x7f) << (7*n);
+    if((p[n] & 0x80) == 0){
+      *value = result;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+size_t fw_journal_encode(uint8_t* buf, uint64_t* time, const FW_JournalEvent* event){
+  int64_t delta = (int64_t)(event->time - *time);
+  size_t n = fw__varint_put(buf, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+  n += fw__varint_put(buf + n, (uint64_t)event->event);
+  n += fw__varint_put(buf + n, event->path_len);
+  memcpy(buf + n, event->path, event->path_len);
+  n += event->path_len;
+  if(event->event == FW_RENAME){
+    n += fw__varint_put(buf + n, event->new_path_len);
+    memcpy(buf + n, event->new_path, event->new_path_len);
+    n += event->new_path_len;
+  }
+  *time = event->time;
+  return n;
+}
+
+bool fw_journal_decode(const uint8_t* data, size_t size, size_t* position, uint64_t* time, FW_JournalEvent* event){
+  const uint8_t* p = data + *position;
+  const uint8_t* end = data + size;
+  uint64_t delta, mask, path_len, new_path_len = 0;
+  size_t n;
+
+  if((n = fw__varint_get(p, end, &delta)) == 0) return false;
+  p += n;
+  if((n = fw__varint_get(p, end, &mask)) == 0) return false;
+  p += n;
+  if((n = fw__varint_get(p, end, &path_len)) == 0 || path_len > (uint64_t)(end - p - n)) return false;
+  p += n;
+  const char* path = (const char*)p;
+  p += path_len;
+  const char* new_path = (const char*)p;
+  if(mask == FW_RENAME){
+    if((n = fw__varint_get(p, end, &new_path_len)) == 0 || new_path_len > (uint64_t)(end - p - n)) return false;
+    p += n;
+    new_path = (const char*)p;
+    p += new_path_len;
+  }
+
+  *time += (delta >> 1) ^ (~(delta & 1) + 1);
+  *position = p - data;
+  event->event = (FW_Event)mask;
+  event->time = *time;
+  event->path = path;
+  event->path_len = path_len;
+  event->new_path = new_path;
+  event->new_path_len = new_path_len;
+  return true;
+}
+
+#if defined(__linux)
+// every segment starts with this header, integers are in host byte order
+typedef struct{
+  char magic[4];
+  uint32_t version;
+  uint64_t offset; // offset of the first event
+  uint64_t time; // base for the time delta of the first event
+} FW__SegmentHeader;
+
+#define FW__JOURNAL_MAGIC "FWJ1"
+#define FW__JOURNAL_BUFFER (64*1024)
+#define FW__JOURNAL_SEGMENT_LIMIT (64*1024*1024)
+
+// 20 digits keep the segments sorted by name
+void fw__segment_name(uint64_t offset, char name[32]){
+  memcpy(name + 20, ".fwj", 5);
+  for(int i = 19; i >= 0; --i){
+    name[i] = (char)('0' + offset % 10);
+    offset /= 10;
+  }
+}
+
+// finds the last segment starting at or before offset
+bool fw__segment_find(int dir, uint64_t offset, uint64_t* start){
+  int fd = dup(dir);
+  if(fd < 0) return false;
+  DIR* d = fdopendir(fd);
+  if(d == NULL){
+    close(fd);
+    return false;
+  }
+  bool found = false;
+  struct dirent* entry;
+  while((entry = readdir(d)) != NULL){
+    if(strlen(entry->d_name) != 24 || strcmp(entry->d_name + 20, ".fwj") != 0) continue;
+    uint64_t value = 0;
+    bool digits = true;
+    for(int i = 0; i < 20; ++i){
+      char c = entry->d_name[i];
+      if(c < '0' || c > '9') digits = false;
+      value = value*10 + (uint64_t)(c - '0');
+    }
+    if(!digits || value > offset) continue;
+    if(!found || value > *start){
+      *start = value;
+      found = true;
+    }
+  }
+  closedir(d);
+  return found;
+}
+
+bool fw__journal_segment(FW_Journal* self, uint64_t time){
+  char name[32];
+  fw__segment_name(self->offset, name);
+  // a segment with this name can only be left over without any events
+  self->fd = openat(self->dir, name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if(self->fd < 0){
+    self->error = errno == EACCES ? FW_E_ACCESS_DENIED : FW_E_IO_ERROR;
+    return false;
+  }
+  FW__SegmentHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FW__JOURNAL_MAGIC, 4);
+  header.version = 1;
+  header.offset = self->offset;
+  header.time = time;
+  memcpy(self->buffer, &header, sizeof(header));
+  self->buffer_size = sizeof(header);
+  self->segment_size = 0;
+  self->time = time;
+  return true;
+}
+
+bool fw_journal_open(FW_Journal* self, const char* path, size_t segment_limit){
+  memset(self, 0, sizeof(*self));
+  self->fd = -1;
+  self->segment_limit = segment_limit > 0 ? segment_limit : FW__JOURNAL_SEGMENT_LIMIT;
+
+  if(mkdir(path, 0755) < 0 && errno != EEXIST){
+    self->error = errno == EACCES ? FW_E_ACCESS_DENIED : FW_E_PATH_NOT_FOUND;
+    return false;
+  }
+
+  // continue after the last complete event of an existing journal
+  FW_Replay replay;
+  if(!fw_replay_open(&replay, path, UINT64_MAX)){
+    self->error = replay.error;
+    return false;
+  }
+  FW_JournalEvent event;
+  while(fw_replay_next(&replay, &event));
+  self->offset = replay.offset;
+  self->dir = replay.dir;
+  replay.dir = -1;
+  fw_replay_close(&replay);
+
+  self->buffer = (char*)FW_REALLOC(NULL, FW__JOURNAL_BUFFER);
+  if(self->buffer == NULL){
+    close(self->dir);
+    self->error = FW_E_PLATFORM_LIMIT;
+    return false;
+  }
+  return true;
+}
+
+bool fw_journal_flush(FW_Journal* self){
+  size_t written = 0;
+  while(written < self->buffer_size){
+    ssize_t n = write(self->fd, self->buffer + written, self->buffer_size - written);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      self->error = FW_E_IO_ERROR;
+      // keep the unwritten part for the next attempt
+      memmove(self->buffer, self->buffer + written, self->buffer_size - written);
+      self->buffer_size -= written;
+      self->segment_size += written;
+      return false;
+    }
+    written += n;
+  }
+  self->segment_size += written;
+  self->buffer_size = 0;
+  return true;
+}
+
+bool fw_journal_append(FW_Journal* self, FW* fw, const FW_Record* record){
+  char path[FW_PATH_MAX];
+  char new_path[FW_PATH_MAX];
+  FW_JournalEvent event;
+  fw__record_paths(fw, record, path, &event.path_len, new_path, &event.new_path_len);
+  event.event = record->event;
+  event.time = record->time;
+  event.path = path;
+  event.new_path = new_path;
+  size_t size = 4*10 + event.path_len + event.new_path_len;
+
+  size_t used = self->segment_size + self->buffer_size;
+  if(self->fd >= 0 && used > sizeof(FW__SegmentHeader) && used + size > self->segment_limit){
+    if(!fw_journal_flush(self)) return false;
+    close(self->fd);
+    self->fd = -1;
+  }
+  if(self->fd < 0){
+    if(self->buffer_size > 0 && !fw_journal_flush(self)) return false;
+    if(!fw__journal_segment(self, record->time)) return false;
+  }
+  if(self->buffer_size + size > FW__JOURNAL_BUFFER && !fw_journal_flush(self)) return false;
+
+  self->buffer_size += fw_journal_encode((uint8_t*)self->buffer + self->buffer_size, &self->time, &event);
+  self->offset++;
+  return true;
+}
+
+bool fw_journal_pump(FW_Journal* self, FW* fw){
+  if(!fw_read(fw)){
+    self->error = fw_error(fw);
+    return false;
+  }
+  FW_Record record;
+  while(fw_next(fw, &record)){
+    if(!fw_journal_append(self, fw, &record)) return false;
+  }
+  // one write for the whole batch
+  return fw_journal_flush(self);
+}
+
+void fw_journal_close(FW_Journal* self){
+  if(self->fd >= 0){
+    fw_journal_flush(self);
+    close(self->fd);
+  }
+  close(self->dir);
+  FW_FREE(self->buffer);
+  self->fd = -1;
+  self->dir = -1;
+  self->buffer = NULL;
+}
+
+// maps the current segment again if it grew, false if it holds no header yet
+bool fw__replay_map(FW_Replay* self){
+  struct stat st;
+  if(fstat(self->fd, &st) < 0 || (size_t)st.st_size < sizeof(FW__SegmentHeader)){
+    self->error = FW_E_NO_EVENT;
+    return false;
+  }
+  if((size_t)st.st_size == self->size) return true;
+
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, self->fd, 0);
+  if(data == MAP_FAILED){
+    self->error = FW_E_IO_ERROR;
+    return false;
+  }
+  if(self->data != NULL){
+    munmap((void*)self->data, self->size);
+  }else{
+    const FW__SegmentHeader* header = (const FW__SegmentHeader*)data;
+    if(memcmp(header->magic, FW__JOURNAL_MAGIC, 4) != 0 || header->version != 1){
+      munmap(data, st.st_size);
+      self->error = FW_E_BAD_STATE;
+      return false;
+    }
+    self->position = sizeof(*header);
+    self->offset = header->offset;
+    self->time = header->time;
+  }
+  self->data = (const uint8_t*)data;
+  self->size = st.st_size;
+  return true;
+}
+
+bool fw__replay_segment(FW_Replay* self, uint64_t start){
+  char name[32];
+  fw__segment_name(start, name);
+  int fd = openat(self->dir, name, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) return false;
+  if(self->data != NULL) munmap((void*)self->data, self->size);
+  if(self->fd >= 0) close(self->fd);
+  self->fd = fd;
+  self->data = NULL;
+  self->size = 0;
+  self->offset = start;
+  return true;
+}
+
+bool fw_replay_open(FW_Replay* self, const char* path, uint64_t offset){
+  memset(self, 0, sizeof(*self));
+  self->fd = -1;
+  self->start = offset;
+  self->dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(self->dir < 0){
+    self->error = errno == EACCES ? FW_E_ACCESS_DENIED : FW_E_PATH_NOT_FOUND;
+    return false;
+  }
+  uint64_t start;
+  if(fw__segment_find(self->dir, offset, &start)){
+    fw__replay_segment(self, start);
+  }
+  return true;
+}
+
+bool fw_replay_next(FW_Replay* self, FW_JournalEvent* event){
+  if(self->fd < 0){
+    // nothing was journaled yet when the replay was opened
+    if(!fw__replay_segment(self, self->offset)){
+      self->error = FW_E_NO_EVENT;
+      return false;
+    }
+  }
+  while(true){
+    if(self->data == NULL && !fw__replay_map(self)) return false;
+
+    if(fw_journal_decode(self->data, self->size, &self->position, &self->time, event)){
+      event->offset = self->offset++;
+      if(event->offset < self->start) continue;
+      return true;
+    }
+
+    // the writer may have appended or moved on to the next segment
+    size_t size = self->size;
+    if(fw__replay_map(self) && self->size != size) continue;
+    if(!fw__replay_segment(self, self->offset)){
+      self->error = FW_E_NO_EVENT;
+      return false;
+    }
+  }
+}
+
+void fw_replay_close(FW_Replay* self){
+  if(self->data != NULL) munmap((void*)self->data, self->size);
+  if(self->fd >= 0) close(self->fd);
+  if(self->dir >= 0) close(self->dir);
+  self->data = NULL;
+  self->fd = -1;
+  self->dir = -1;
+}
+#endif
 #endif // FW_IMPLEMENTATION
+
+#ifdef __cplusplus
+}
+#endif
 #endif // FW_H_
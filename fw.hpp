@@ -0,0 +1,474 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 Alaric de Ruiter
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// C++17 wrapper around fw.h, define FW_IMPLEMENTATION in exactly one
+// translation unit before including it just like with fw.h
+#ifndef FW_HPP_
+#define FW_HPP_
+#include "fw.h"
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if __cplusplus >= 202002L && defined(__linux) && __has_include(<coroutine>)
+#define FW_COROUTINES
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <sys/epoll.h>
+#include <vector>
+#endif
+
+constexpr FW_Event operator|(FW_Event a, FW_Event b){
+  return static_cast<FW_Event>(static_cast<int>(a) | static_cast<int>(b));
+}
+
+constexpr FW_Flags operator|(FW_Flags a, FW_Flags b){
+  return static_cast<FW_Flags>(static_cast<int>(a) | static_cast<int>(b));
+}
+
+namespace fw{
+
+class Error : public std::runtime_error{
+public:
+  explicit Error(FW_Error code)
+    : std::runtime_error(fw_strerror(code)), code_(code){}
+
+  FW_Error code() const noexcept { return code_; }
+
+private:
+  FW_Error code_;
+};
+
+// a single event, the names point into the read buffer of the watcher
+// and stay valid until the next poll() of that watcher
+struct Event{
+  FW_Event type;
+  std::string_view name;
+  std::string_view new_name; // only set for FW_RENAME
+  uint64_t time; // monotonic nanoseconds at which the batch was read
+  FW_Record record;
+
+  bool incomplete() const noexcept {
+    return type == FW_RENAME && (name.empty() || new_name.empty());
+  }
+};
+
+// filters are types with a static match(std::string_view), a Watcher
+// combines its filters into the filter callback of its options, see
+// Suffix and Glob
+
+// matches names ending in any of the suffixes
+template<const char*... Suffixes>
+struct Suffix{
+  static constexpr bool match(std::string_view name) noexcept {
+    return (ends_with(name, Suffixes) || ...);
+  }
+
+private:
+  static constexpr bool ends_with(std::string_view name, std::string_view suffix) noexcept {
+    return name.size() >= suffix.size()
+      && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+};
+
+// matches names against a pattern where '*' matches any number of
+// characters and '?' exactly one
+template<const char* Pattern>
+struct Glob{
+  static constexpr bool match(std::string_view name) noexcept {
+    std::string_view pattern = Pattern;
+    size_t p = 0, n = 0;
+    size_t star = std::string_view::npos, star_n = 0;
+    while(n < name.size()){
+      if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])){
+        p++;
+        n++;
+      }else if(p < pattern.size() && pattern[p] == '*'){
+        star = p++;
+        star_n = n;
+      }else if(star != std::string_view::npos){
+        p = star + 1;
+        n = ++star_n;
+      }else{
+        return false;
+      }
+    }
+    while(p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+  }
+};
+
+// the events of a single read, iterated in place without copying, the
+// names passed the filter of the watcher already when fw_next parsed them
+class Batch{
+public:
+  class Sentinel{};
+
+  class Iterator{
+  public:
+    explicit Iterator(FW* fw) : fw_(fw){ advance(); }
+
+    Event& operator*() noexcept { return event_; }
+    Event* operator->() noexcept { return &event_; }
+    Iterator& operator++(){
+      advance();
+      return *this;
+    }
+    bool operator!=(Sentinel) const noexcept { return fw_ != nullptr; }
+    bool operator==(Sentinel) const noexcept { return fw_ == nullptr; }
+
+  private:
+    void advance(){
+      if(fw_ == nullptr) return;
+      if(!fw_next(fw_, &event_.record)){
+        fw_ = nullptr;
+        return;
+      }
+      event_.name = std::string_view(event_.record.name, event_.record.name_len);
+      event_.new_name = std::string_view(event_.record.new_name, event_.record.new_name_len);
+      event_.type = event_.record.event;
+      event_.time = event_.record.time;
+    }
+
+    FW* fw_;
+    Event event_{};
+  };
+
+  explicit Batch(FW* fw) noexcept : fw_(fw){}
+
+  Iterator begin(){ return Iterator(fw_); }
+  Sentinel end() const noexcept { return Sentinel{}; }
+
+private:
+  FW* fw_;
+};
+
+// owns a watch context, can be moved but not copied
+//
+// Watcher<> takes the events at runtime, Watcher<Mask, Filter...> takes
+// them as template arguments and only yields events whose names pass
+// every filter, e.g. Watcher<FW_CREATE | FW_MODIFY, Suffix<cpp, hpp>>,
+// the filters replace the filter of the options
+template<FW_Event Mask = static_cast<FW_Event>(0), class... Filter>
+class Watcher{
+  static_assert((Mask & ~(FW_ALL | FW_DELETE_TREE | FW_ROOT_LOST | FW_ROOT_BACK)) == 0, "Mask must be a combination of FW_Event values");
+
+public:
+  template<FW_Event M = Mask, typename std::enable_if<M == 0, int>::type = 0>
+  Watcher(const char* path, FW_Event events, const FW_Options* options = nullptr)
+    : fw_(new FW){
+    init(path, events, options);
+  }
+
+  template<FW_Event M = Mask, typename std::enable_if<M == 0, int>::type = 0>
+  Watcher(const std::string& path, FW_Event events, const FW_Options* options = nullptr)
+    : Watcher(path.c_str(), events, options){}
+
+  template<FW_Event M = Mask, typename std::enable_if<M != 0, int>::type = 0>
+  explicit Watcher(const char* path, const FW_Options* options = nullptr)
+    : fw_(new FW){
+    init(path, Mask, options);
+  }
+
+  template<FW_Event M = Mask, typename std::enable_if<M != 0, int>::type = 0>
+  explicit Watcher(const std::string& path, const FW_Options* options = nullptr)
+    : Watcher(path.c_str(), options){}
+
+  ~Watcher(){
+    if(fw_ != nullptr) fw_deinit(fw_.get());
+  }
+
+  Watcher(Watcher&&) noexcept = default;
+  Watcher& operator=(Watcher&& other) noexcept {
+    if(this != &other){
+      if(fw_ != nullptr) fw_deinit(fw_.get());
+      fw_ = std::move(other.fw_);
+    }
+    return *this;
+  }
+  Watcher(const Watcher&) = delete;
+  Watcher& operator=(const Watcher&) = delete;
+
+  // blocks until events are available unless events of the previous
+  // batch are left, those are returned first
+  Batch poll(){
+    if(!fw_read(fw_.get())){
+      throw Error(fw_error(fw_.get()));
+    }
+    return Batch(fw_.get());
+  }
+
+  std::string path(const Event& event) const {
+    return path(event.record, fw_record_path);
+  }
+
+  std::string new_path(const Event& event) const {
+    return path(event.record, fw_record_new_path);
+  }
+
+  // changes the events of a runtime Watcher<> without dropping queued ones
+  template<FW_Event M = Mask, typename std::enable_if<M == 0, int>::type = 0>
+  void set_events(FW_Event events){
+    if(!fw_set_events(fw_.get(), events)){
+      throw Error(fw_error(fw_.get()));
+    }
+  }
+
+  FW_Stats stats() const { return fw_stats(fw_.get()); }
+  FW* get() const noexcept { return fw_.get(); }
+
+private:
+  void init(const char* path, FW_Event events, const FW_Options* options){
+    FW_Options filtered;
+    if constexpr(sizeof...(Filter) > 0){
+      // called by fw_next so skipped events are never delivered
+      filtered = options != nullptr ? *options : FW_Options{};
+      filtered.filter = accept;
+      filtered.filter_data = nullptr;
+      options = &filtered;
+    }
+    if(!fw_init_ex(fw_.get(), path, events, options)){
+      throw Error(fw_error(fw_.get()));
+    }
+  }
+
+  static bool accept(const char* name, size_t len, void*) noexcept {
+    return (Filter::match(std::string_view(name, len)) && ...);
+  }
+
+  std::string path(const FW_Record& record, size_t (*get_path)(FW*, const FW_Record*, char*, size_t)) const {
+    char buf[FW_PATH_MAX];
+    size_t len = get_path(fw_.get(), &record, buf, sizeof(buf));
+    if(len < sizeof(buf)) return std::string(buf, len);
+    std::string result(len, '\0');
+    get_path(fw_.get(), &record, result.data(), len+1);
+    return result;
+  }
+
+  // heap allocated once so moves never relocate the read buffer
+  std::unique_ptr<FW> fw_;
+};
+
+#ifdef FW_COROUTINES
+// a detached coroutine started by Executor::spawn, it only runs
+// once the executor runs and is destroyed by it when finished
+class Task{
+public:
+  struct promise_type{
+    std::exception_ptr exception;
+
+    Task get_return_object() noexcept {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+  };
+
+  Task(Task&& other) noexcept : handle_(other.handle_){ other.handle_ = nullptr; }
+  Task& operator=(Task&&) = delete;
+  ~Task(){
+    if(handle_) handle_.destroy();
+  }
+
+  std::coroutine_handle<promise_type> release() noexcept {
+    auto handle = handle_;
+    handle_ = nullptr;
+    return handle;
+  }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle){}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// reference single threaded executor, resumes coroutines waiting on a
+// watcher once epoll reports its descriptor readable or fw_timeout
+// expires, so polled directories and held deletions still arrive
+class Executor{
+public:
+  Executor() : epoll_(epoll_create1(EPOLL_CLOEXEC)){
+    if(epoll_ < 0) throw Error(FW_E_PLATFORM_LIMIT);
+  }
+
+  // tasks that did not finish are destroyed with their locals
+  ~Executor(){
+    for(auto handle : ready_) handle.destroy();
+    for(const Waiter& waiter : waiting_) waiter.handle.destroy();
+    close(epoll_);
+  }
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  void spawn(Task task){
+    ready_.push_back(task.release());
+  }
+
+  // runs until every task finished or stop() was called, exceptions
+  // escaping a task are rethrown here
+  void run(){
+    stopped_ = false;
+    while(!stopped_ && (!ready_.empty() || !waiting_.empty())){
+      while(!stopped_ && !ready_.empty()){
+        auto handle = ready_.front();
+        ready_.pop_front();
+        handle.resume();
+        if(handle.done()){
+          std::exception_ptr exception = handle.promise().exception;
+          handle.destroy();
+          if(exception) std::rethrow_exception(exception);
+        }
+      }
+      if(stopped_ || waiting_.empty()) break;
+
+      // the earliest time a watcher has to read without an event
+      int timeout = -1;
+      for(const Waiter& waiter : waiting_){
+        int wait = fw_timeout(waiter.fw);
+        if(wait >= 0 && (timeout < 0 || wait < timeout)) timeout = wait;
+      }
+      epoll_event events[64];
+      int n = epoll_wait(epoll_, events, 64, timeout);
+      if(n < 0){
+        if(errno == EINTR) continue;
+        throw Error(FW_E_UNKNOWN);
+      }
+      for(int i = 0; i < n; ++i) resume(events[i].data.fd);
+      if(timeout < 0) continue;
+      for(std::size_t i = 0; i < waiting_.size();){
+        if(fw_timeout(waiting_[i].fw) != 0){
+          i++;
+          continue;
+        }
+        // disarmed until it waits again
+        epoll_event event{};
+        epoll_ctl(epoll_, EPOLL_CTL_MOD, waiting_[i].fd, &event);
+        resume(waiting_[i].fd);
+      }
+    }
+  }
+
+  void stop() noexcept { stopped_ = true; }
+
+  // resumes the coroutine once the descriptor of fw becomes readable or
+  // fw_timeout expires, only coroutines spawned as Task may wait
+  void wait_readable(FW* fw, std::coroutine_handle<> handle){
+    int fd = fw_fd(fw);
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+    if(epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event) < 0){
+      if(errno != ENOENT || epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) < 0){
+        throw Error(FW_E_PLATFORM_LIMIT);
+      }
+    }
+    waiting_.push_back({fd, fw, std::coroutine_handle<Task::promise_type>::from_address(handle.address())});
+  }
+
+private:
+  struct Waiter{
+    int fd;
+    FW* fw;
+    std::coroutine_handle<Task::promise_type> handle;
+  };
+
+  void resume(int fd){
+    for(std::size_t i = 0; i < waiting_.size(); ++i){
+      if(waiting_[i].fd != fd) continue;
+      ready_.push_back(waiting_[i].handle);
+      waiting_[i] = waiting_.back();
+      waiting_.pop_back();
+      return;
+    }
+  }
+
+  int epoll_;
+  bool stopped_ = false;
+  std::vector<Waiter> waiting_;
+  std::deque<std::coroutine_handle<Task::promise_type>> ready_;
+};
+
+// a watcher that never blocks, co_await next() suspends the calling
+// task until the executor sees events and resumes it with their batch
+class AsyncWatcher{
+public:
+  class NextAwaiter{
+  public:
+    explicit NextAwaiter(AsyncWatcher& watcher) noexcept : watcher_(watcher){}
+
+    bool await_ready(){
+      // events left from the previous batch or already queued
+      return fw_read(watcher_.get()) || fw_error(watcher_.get()) != FW_E_NO_EVENT;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle){
+      watcher_.executor_.wait_readable(watcher_.get(), handle);
+    }
+
+    Batch await_resume(){
+      if(!fw_read(watcher_.get()) && fw_error(watcher_.get()) != FW_E_NO_EVENT){
+        throw Error(fw_error(watcher_.get()));
+      }
+      // an empty batch on a spurious wakeup
+      return Batch(watcher_.get());
+    }
+
+  private:
+    AsyncWatcher& watcher_;
+  };
+
+  AsyncWatcher(Executor& executor, const char* path, FW_Event events, const FW_Options* options = nullptr)
+    : executor_(executor), watcher_(path, events, nonblocking(options)){}
+
+  NextAwaiter next() noexcept { return NextAwaiter(*this); }
+
+  std::string path(const Event& event) const { return watcher_.path(event); }
+  std::string new_path(const Event& event) const { return watcher_.new_path(event); }
+  FW_Stats stats() const { return watcher_.stats(); }
+  FW* get() const noexcept { return watcher_.get(); }
+
+private:
+  static const FW_Options* nonblocking(const FW_Options* options){
+    static thread_local FW_Options copy;
+    copy = options != nullptr ? *options : FW_Options{};
+    copy.flags = copy.flags | FW_NONBLOCK;
+    return &copy;
+  }
+
+  Executor& executor_;
+  Watcher<> watcher_;
+};
+#endif // FW_COROUTINES
+
+} // namespace fw
+
+#endif // FW_HPP_
@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FW_IMPLEMENTATION
+#include "fw.h"
+
+// Protocol
+//   server -> client  "FWD1" once after accepting
+//   client -> server  the subscription as a single event in the journal
+//                     encoding, the event is the mask and the path the prefix
+//   server -> client  frames of a u32 little endian length followed by
+//                     events in the journal encoding, one frame per read
+// paths are relative to the watched directory, only events whose path
+// (or new path for renames) is the prefix or below it are sent and the
+// time deltas chain across all frames of a connection
+
+#define FWD_MAGIC "FWD1"
+#define FWD_MAX_CLIENTS 256
+// clients that fall this far behind are disconnected
+#define FWD_OUTPUT_LIMIT (4*1024*1024)
+#define FWD_LISTEN 0
+#define FWD_WATCH 1
+#define FWD_CLIENT 2
+
+typedef struct{
+  int fd; // -1 when unused
+  bool subscribed;
+  FW_Event mask;
+  char prefix[FW_PATH_MAX];
+  size_t prefix_len;
+  uint8_t input[FW_PATH_MAX + 32];
+  size_t input_size;
+  uint8_t* output;
+  size_t output_size;
+  size_t output_sent;
+  size_t output_capacity;
+  size_t frame;
+  bool writing; // waiting for EPOLLOUT
+  uint64_t time;
+} Fwd_Client;
+
+typedef struct{
+  const char* root;
+  size_t root_len;
+  int epoll;
+  int listen;
+  FW fw;
+  Fwd_Client clients[FWD_MAX_CLIENTS];
+} Fwd;
+
+static volatile sig_atomic_t fwd_stop;
+
+static void fwd_signal(int signal){
+  (void)signal;
+  fwd_stop = 1;
+}
+
+static void fwd_drop(Fwd* fwd, Fwd_Client* client){
+  epoll_ctl(fwd->epoll, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  free(client->output);
+  memset(client, 0, sizeof(*client));
+  client->fd = -1;
+}
+
+static bool fwd_reserve(Fwd_Client* client, size_t size){
+  if(client->output_size + size <= client->output_capacity) return true;
+  if(client->output_size + size > FWD_OUTPUT_LIMIT) return false;
+  size_t capacity = client->output_capacity > 0 ? client->output_capacity : 64*1024;
+  while(capacity < client->output_size + size) capacity *= 2;
+  uint8_t* output = realloc(client->output, capacity);
+  if(output == NULL) return false;
+  client->output = output;
+  client->output_capacity = capacity;
+  return true;
+}
+
+static bool fwd_send(Fwd* fwd, Fwd_Client* client){
+  while(client->output_sent < client->output_size){
+    ssize_t n = send(client->fd, client->output + client->output_sent,
+        client->output_size - client->output_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      if(errno != EAGAIN) return false;
+      if(!client->writing){
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.u32 = FWD_CLIENT + (client - fwd->clients)};
+        epoll_ctl(fwd->epoll, EPOLL_CTL_MOD, client->fd, &ev);
+        client->writing = true;
+      }
+      return true;
+    }
+    client->output_sent += n;
+  }
+  client->output_size = 0;
+  client->output_sent = 0;
+  if(client->writing){
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = FWD_CLIENT + (client - fwd->clients)};
+    epoll_ctl(fwd->epoll, EPOLL_CTL_MOD, client->fd, &ev);
+    client->writing = false;
+  }
+  return true;
+}
+
+static void fwd_accept(Fwd* fwd){
+  while(true){
+    int fd = accept4(fwd->listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(fd < 0) return;
+
+    Fwd_Client* client = NULL;
+    for(int i = 0; i < FWD_MAX_CLIENTS; ++i){
+      if(fwd->clients[i].fd < 0){
+        client = &fwd->clients[i];
+        break;
+      }
+    }
+    if(client == NULL){
+      close(fd);
+      continue;
+    }
+    client->fd = fd;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = FWD_CLIENT + (client - fwd->clients)};
+    if(epoll_ctl(fwd->epoll, EPOLL_CTL_ADD, fd, &ev) < 0
+        || !fwd_reserve(client, 4)){
+      fwd_drop(fwd, client);
+      continue;
+    }
+    memcpy(client->output, FWD_MAGIC, 4);
+    client->output_size = 4;
+    if(!fwd_send(fwd, client)) fwd_drop(fwd, client);
+  }
+}
+
+// reads the subscription, anything after it is ignored
+static void fwd_receive(Fwd* fwd, Fwd_Client* client){
+  while(true){
+    uint8_t discard[256];
+    uint8_t* buf = client->subscribed ? discard : client->input + client->input_size;
+    size_t size = client->subscribed ? sizeof(discard) : sizeof(client->input) - client->input_size;
+    ssize_t n = read(client->fd, buf, size);
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || size == 0){
+      fwd_drop(fwd, client);
+      return;
+    }
+    if(n < 0){
+      if(errno == EINTR) continue;
+      return;
+    }
+    if(client->subscribed) continue;
+    client->input_size += n;
+
+    FW_JournalEvent sub;
+    size_t position = 0;
+    uint64_t time = 0;
+    if(!fw_journal_decode(client->input, client->input_size, &position, &time, &sub)) continue;
+    if(sub.path_len >= sizeof(client->prefix)){
+      fwd_drop(fwd, client);
+      return;
+    }
+    client->mask = sub.event;
+    memcpy(client->prefix, sub.path, sub.path_len);
+    client->prefix_len = sub.path_len;
+    client->subscribed = true;
+  }
+}
+
+// whole components only, a "src" subscription does not see "src2/..."
+static bool fwd_below(const Fwd_Client* client, const char* path, size_t len){
+  size_t prefix_len = client->prefix_len;
+  if(len < prefix_len || memcmp(path, client->prefix, prefix_len) != 0) return false;
+  return prefix_len == 0 || len == prefix_len || path[prefix_len] == '/'
+    || client->prefix[prefix_len-1] == '/';
+}
+
+static bool fwd_match(const Fwd_Client* client, const FW_JournalEvent* event){
+  if(!client->subscribed || (client->mask & event->event) == 0) return false;
+  if(fwd_below(client, event->path, event->path_len)) return true;
+  return event->event == FW_RENAME && fwd_below(client, event->new_path, event->new_path_len);
+}
+
+static size_t fwd_relative(Fwd* fwd, char* path, size_t len){
+  if(len >= fwd->root_len && memcmp(path, fwd->root, fwd->root_len) == 0){
+    size_t skip = fwd->root_len;
+    if(skip < len && path[skip] == '/') skip++;
+    memmove(path, path + skip, len - skip + 1);
+    len -= skip;
+  }
+  return len;
+}
+
+// encodes every event once per client into one frame per read,
+// returns false once the queue is drained or on error
+static bool fwd_batch(Fwd* fwd){
+  if(!fw_read(&fwd->fw)) return false;
+
+  for(int i = 0; i < FWD_MAX_CLIENTS; ++i){
+    Fwd_Client* client = &fwd->clients[i];
+    client->frame = SIZE_MAX;
+  }
+
+  char path[FW_PATH_MAX];
+  char new_path[FW_PATH_MAX];
+  FW_Record record;
+  while(fw_next(&fwd->fw, &record)){
+    FW_JournalEvent event = {
+      .event = record.event,
+      .time = record.time,
+      .path = path,
+      .new_path = new_path,
+    };
+    event.path_len = fw_record_path(&fwd->fw, &record, path, sizeof(path));
+    if(event.path_len >= sizeof(path)) continue;
+    event.path_len = fwd_relative(fwd, path, event.path_len);
+    if(record.event == FW_RENAME){
+      event.new_path_len = fw_record_new_path(&fwd->fw, &record, new_path, sizeof(new_path));
+      if(event.new_path_len >= sizeof(new_path)) continue;
+      event.new_path_len = fwd_relative(fwd, new_path, event.new_path_len);
+    }
+
+    for(int i = 0; i < FWD_MAX_CLIENTS; ++i){
+      Fwd_Client* client = &fwd->clients[i];
+      if(client->fd < 0 || !fwd_match(client, &event)) continue;
+      if(!fwd_reserve(client, 4 + FW_JOURNAL_MAX_EVENT)){
+        fprintf(stderr, "fwd: client %d is too slow, disconnecting\n", i);
+        fwd_drop(fwd, client);
+        continue;
+      }
+      if(client->frame == SIZE_MAX){
+        client->frame = client->output_size;
+        client->output_size += 4;
+      }
+      client->output_size += fw_journal_encode(client->output + client->output_size, &client->time, &event);
+    }
+  }
+
+  for(int i = 0; i < FWD_MAX_CLIENTS; ++i){
+    Fwd_Client* client = &fwd->clients[i];
+    if(client->fd < 0 || client->frame == SIZE_MAX) continue;
+    uint32_t len = (uint32_t)(client->output_size - client->frame - 4);
+    for(int b = 0; b < 4; ++b){
+      client->output[client->frame + b] = (uint8_t)(len >> (8*b));
+    }
+    if(!client->writing && !fwd_send(fwd, client)) fwd_drop(fwd, client);
+  }
+  return true;
+}
+
+static int fwd_connect(const char* socket_path){
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if(strlen(socket_path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "fwd: socket path too long\n");
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+    perror(socket_path);
+    if(fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int fwd_serve(const char* root, const char* socket_path){
+  static Fwd fwd;
+  fwd.root = root;
+  fwd.root_len = strlen(root);
+  for(int i = 0; i < FWD_MAX_CLIENTS; ++i) fwd.clients[i].fd = -1;
+
+  // clients are served while the rest of the tree is still being registered
+  FW_Options options = {.flags = FW_RECURSIVE | FW_NONBLOCK | FW_LAZY};
+  if(!fw_init_ex(&fwd.fw, root, FW_ALL, &options)){
+    fprintf(stderr, "fwd: %s: %s\n", root, fw_strerror(fw_error(&fwd.fw)));
+    return 1;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if(strlen(socket_path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "fwd: socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+  // a socket left behind by a daemon that is no longer running
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0){
+    fprintf(stderr, "fwd: %s is already served\n", socket_path);
+    return 1;
+  }
+  close(probe);
+  unlink(socket_path);
+
+  fwd.listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fwd.listen < 0
+      || bind(fwd.listen, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(fwd.listen, 64) < 0){
+    perror(socket_path);
+    return 1;
+  }
+
+  fwd.epoll = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = {.events = EPOLLIN, .data.u32 = FWD_LISTEN};
+  epoll_ctl(fwd.epoll, EPOLL_CTL_ADD, fwd.listen, &ev);
+  ev.data.u32 = FWD_WATCH;
+  epoll_ctl(fwd.epoll, EPOLL_CTL_ADD, fw_fd(&fwd.fw), &ev);
+
+  signal(SIGINT, fwd_signal);
+  signal(SIGTERM, fwd_signal);
+  fprintf(stderr, "fwd: serving %s on %s\n", root, socket_path);
+
+  int status = 0;
+  while(!fwd_stop){
+    struct epoll_event events[64];
+    // directories beyond the watch limit are polled on a timer
+    int n = epoll_wait(fwd.epoll, events, 64, fw_timeout(&fwd.fw));
+    if(n < 0){
+      if(errno == EINTR) continue;
+      perror("epoll_wait");
+      status = 1;
+      break;
+    }
+    if(n == 0){
+      // the poll interval is over, handled like a readable watch
+      events[0].events = EPOLLIN;
+      events[0].data.u32 = FWD_WATCH;
+      n = 1;
+    }
+    for(int i = 0; i < n; ++i){
+      uint32_t id = events[i].data.u32;
+      if(id == FWD_LISTEN){
+        fwd_accept(&fwd);
+      }else if(id == FWD_WATCH){
+        while(fwd_batch(&fwd));
+        if(fw_error(&fwd.fw) != FW_E_NO_EVENT){
+          fprintf(stderr, "fwd: %s\n", fw_strerror(fw_error(&fwd.fw)));
+          fwd_stop = 1;
+          status = 1;
+        }
+      }else{
+        Fwd_Client* client = &fwd.clients[id - FWD_CLIENT];
+        if(client->fd < 0) continue;
+        if(events[i].events & (EPOLLERR | EPOLLHUP)){
+          fwd_drop(&fwd, client);
+          continue;
+        }
+        if(events[i].events & EPOLLOUT){
+          if(!fwd_send(&fwd, client)){
+            fwd_drop(&fwd, client);
+            continue;
+          }
+        }
+        if(events[i].events & EPOLLIN) fwd_receive(&fwd, client);
+      }
+    }
+  }
+
+  for(int i = 0; i < FWD_MAX_CLIENTS; ++i){
+    if(fwd.clients[i].fd >= 0) fwd_drop(&fwd, &fwd.clients[i]);
+  }
+  close(fwd.listen);
+  close(fwd.epoll);
+  unlink(socket_path);
+  fw_deinit(&fwd.fw);
+  return status;
+}
+
+static bool fwd_read_all(int fd, uint8_t* buf, size_t size){
+  while(size > 0){
+    ssize_t n = read(fd, buf, size);
+    if(n <= 0){
+      if(n < 0 && errno == EINTR) continue;
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+// a minimal client that prints the events it is sent
+static int fwd_watch(const char* socket_path, FW_Event mask, const char* prefix){
+  int fd = fwd_connect(socket_path);
+  if(fd < 0) return 1;
+
+  uint8_t magic[4];
+  if(!fwd_read_all(fd, magic, 4) || memcmp(magic, FWD_MAGIC, 4) != 0){
+    fprintf(stderr, "fwd: %s does not speak %s\n", socket_path, FWD_MAGIC);
+    return 1;
+  }
+
+  FW_JournalEvent sub = {.event = mask, .path = prefix, .path_len = strlen(prefix)};
+  uint8_t message[FW_JOURNAL_MAX_EVENT];
+  uint64_t time = 0;
+  size_t size = fw_journal_encode(message, &time, &sub);
+  if(write(fd, message, size) != (ssize_t)size){
+    perror("write");
+    return 1;
+  }
+
+  uint8_t* frame = NULL;
+  time = 0;
+  while(true){
+    uint8_t header[4];
+    if(!fwd_read_all(fd, header, 4)) break;
+    uint32_t len = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    frame = realloc(frame, len);
+    if(frame == NULL || !fwd_read_all(fd, frame, len)) break;
+
+    size_t position = 0;
+    FW_JournalEvent event;
+    while(position < len && fw_journal_decode(frame, len, &position, &time, &event)){
+      if(event.event == FW_RENAME){
+        printf("rename: %.*s -> %.*s\n", (int)event.path_len, event.path, (int)event.new_path_len, event.new_path);
+      }else{
+        const char* type = event.event == FW_CREATE ? "created" : event.event == FW_DELETE ? "deleted" : "modified";
+        printf("%s: %.*s\n", type, (int)event.path_len, event.path);
+      }
+    }
+    fflush(stdout);
+  }
+  free(frame);
+  close(fd);
+  return 0;
+}
+
+static void fwd_usage(const char* program){
+  printf("usage: %s serve <dir> [-s <socket>]\n", program);
+  printf("       %s watch [-s <socket>] [-e <events>] [-p <prefix>]\n", program);
+  printf("  -s <socket>      unix socket of the daemon (default /tmp/fwd.sock)\n");
+  printf("  -e <events>      any of c(reate), d(elete), m(odify) and r(ename) (default cdmr)\n");
+  printf("  -p <prefix>      only events below this path relative to the served directory\n");
+}
+
+int main(int argc, char** argv){
+  const char* program = *argv;
+  argv++;
+  argc--;
+  if(argc < 1){
+    fwd_usage(program);
+    return 1;
+  }
+  const char* command = *argv;
+  argv++;
+  argc--;
+
+  const char* root = NULL;
+  if(strcmp(command, "serve") == 0 && argc > 0){
+    root = *argv;
+    argv++;
+    argc--;
+  }
+
+  const char* socket_path = "/tmp/fwd.sock";
+  const char* prefix = "";
+  FW_Event mask = FW_ALL;
+  while(argc >= 2){
+    const char* flag = argv[0];
+    const char* value = argv[1];
+    if(strcmp(flag, "-s") == 0) socket_path = value;
+    else if(strcmp(flag, "-p") == 0) prefix = value;
+    else if(strcmp(flag, "-e") == 0){
+      mask = (FW_Event)0;
+      for(const char* c = value; *c; ++c){
+        if(*c == 'c') mask = (FW_Event)(mask | FW_CREATE);
+        else if(*c == 'd') mask = (FW_Event)(mask | FW_DELETE);
+        else if(*c == 'm') mask = (FW_Event)(mask | FW_MODIFY);
+        else if(*c == 'r') mask = (FW_Event)(mask | FW_RENAME);
+      }
+    }else{
+      fwd_usage(program);
+      return 1;
+    }
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc != 0){
+    fwd_usage(program);
+    return 1;
+  }
+
+  if(strcmp(command, "serve") == 0 && root != NULL) return fwd_serve(root, socket_path);
+  if(strcmp(command, "watch") == 0) return fwd_watch(socket_path, mask, prefix);
+  fwd_usage(program);
+  return 1;
+}
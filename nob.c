@@ -15,7 +15,69 @@ int main(int argc, char** argv){
 
   const char* target = "./app";
 #if defined(__linux)
-  if(command != NULL 
+  if(command != NULL
+      && strcmp(command, "bench") == 0
+  ){
+    target = "./bench";
+    nob_cc(&cmd);
+    nob_cc_flags(&cmd);
+    nob_cmd_append(&cmd, "-O2");
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "bench.c");
+    nob_cmd_append(&cmd, "-lpthread");
+  }else if(command != NULL
+      && strcmp(command, "stress") == 0
+  ){
+    target = "./stress";
+    nob_cc(&cmd);
+    nob_cc_flags(&cmd);
+    nob_cmd_append(&cmd, "-O2");
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "stress.c");
+    nob_cmd_append(&cmd, "-lpthread");
+  }else if(command != NULL
+      && strcmp(command, "test") == 0
+  ){
+    target = "./test";
+    nob_cc(&cmd);
+    nob_cc_flags(&cmd);
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "test.c");
+  }else if(command != NULL
+      && strcmp(command, "fwd") == 0
+  ){
+    target = "./fwd";
+    nob_cc(&cmd);
+    nob_cc_flags(&cmd);
+    nob_cmd_append(&cmd, "-O2");
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "fwd.c");
+  }else if(command != NULL
+      && strcmp(command, "cpp") == 0
+  ){
+    target = "./app_cpp";
+    nob_cmd_append(&cmd, "c++", "-std=c++17");
+    nob_cc_flags(&cmd);
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "example.cpp");
+  }else if(command != NULL
+      && strcmp(command, "async") == 0
+  ){
+    target = "./app_async";
+    nob_cmd_append(&cmd, "c++", "-std=c++20");
+    nob_cc_flags(&cmd);
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "example_async.cpp");
+  }else if(command != NULL
+      && strcmp(command, "bench_cpp") == 0
+  ){
+    target = "./bench_cpp";
+    nob_cmd_append(&cmd, "c++", "-std=c++17");
+    nob_cc_flags(&cmd);
+    nob_cmd_append(&cmd, "-O2");
+    nob_cc_output(&cmd, target);
+    nob_cc_inputs(&cmd, "bench.cpp");
+  }else if(command != NULL 
       && strcmp(command, "cross") == 0
   ){
     target = "./app.exe";
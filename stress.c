@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define FW_IMPLEMENTATION
+#include "fw.h"
+
+typedef enum{
+  STRESS_CREATE,
+  STRESS_MODIFY,
+  STRESS_DELETE,
+  STRESS_RENAME,
+  STRESS_OP_COUNT,
+} Stress_Op;
+
+static const char* stress_op_names[STRESS_OP_COUNT] = {"create", "modify", "delete", "rename"};
+
+typedef struct{
+  uint64_t seed;
+  long ops; // per thread
+  int threads;
+  int fan_out; // directories per thread
+  long rate; // total ops per second, 0 is unlimited
+  int mix[STRESS_OP_COUNT];
+  const char* root;
+  const char* log;
+} Stress_Profile;
+
+typedef struct{
+  Stress_Op op;
+  long file;
+  long new_file;
+  int dir;
+  int new_dir;
+} Stress_Entry;
+
+typedef struct{
+  const Stress_Profile* profile;
+  int index;
+  uint64_t rng;
+  long* live; // ids of existing files
+  long live_count;
+  long next_file;
+  int* file_dir; // directory of every file id
+  Stress_Entry* entries;
+  long entry_count;
+} Stress_Thread;
+
+// last operation time per file, indexed by thread*ops + file
+static _Atomic uint64_t* stress_sent;
+static atomic_long stress_received[STRESS_OP_COUNT];
+static atomic_long stress_incomplete;
+static atomic_bool stress_ready;
+static atomic_bool stress_done;
+static uint64_t* stress_latency;
+static atomic_long stress_latency_count;
+static _Atomic uint64_t stress_cpu;
+// scraped by the main thread while the consumer is running
+static FW stress_fw;
+
+static uint64_t stress_now(clockid_t clock){
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// splitmix64, every thread gets its own deterministic sequence
+static uint64_t stress_random(uint64_t* state){
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static void stress_path(const Stress_Profile* profile, int thread, int dir, long file, char* buf, size_t size){
+  if(file < 0){
+    snprintf(buf, size, "%s/t%d/d%d", profile->root, thread, dir);
+  }else{
+    snprintf(buf, size, "%s/t%d/d%d/t%d_%ld", profile->root, thread, dir, thread, file);
+  }
+}
+
+static Stress_Op stress_pick(Stress_Thread* thread){
+  const int* mix = thread->profile->mix;
+  int total = 0;
+  for(int i = 0; i < STRESS_OP_COUNT; ++i) total += mix[i];
+  int pick = stress_random(&thread->rng) % total;
+  Stress_Op op = STRESS_CREATE;
+  for(int i = 0; i < STRESS_OP_COUNT; ++i){
+    if(pick < mix[i]){
+      op = i;
+      break;
+    }
+    pick -= mix[i];
+  }
+  // everything except create needs an existing file
+  if(thread->live_count == 0) op = STRESS_CREATE;
+  return op;
+}
+
+static void stress_mark(Stress_Thread* thread, long file){
+  long i = (long)thread->index*thread->profile->ops + file;
+  atomic_store_explicit(&stress_sent[i], stress_now(CLOCK_MONOTONIC), memory_order_relaxed);
+}
+
+static void* stress_produce(void* arg){
+  Stress_Thread* thread = arg;
+  const Stress_Profile* profile = thread->profile;
+  char path[FW_PATH_MAX];
+  char new_path[FW_PATH_MAX];
+  uint64_t start = stress_now(CLOCK_MONOTONIC);
+  double interval = profile->rate > 0 ? 1e9*profile->threads/profile->rate : 0;
+
+  for(long i = 0; i < profile->ops; ++i){
+    if(interval > 0){
+      uint64_t due = start + (uint64_t)(i*interval);
+      uint64_t now = stress_now(CLOCK_MONOTONIC);
+      if(due > now){
+        struct timespec ts = {.tv_sec = (due-now)/1000000000ull, .tv_nsec = (due-now)%1000000000ull};
+        nanosleep(&ts, NULL);
+      }
+    }
+
+    Stress_Entry* entry = &thread->entries[thread->entry_count++];
+    entry->op = stress_pick(thread);
+    long pick = thread->live_count > 0 ? (long)(stress_random(&thread->rng) % thread->live_count) : 0;
+
+    switch(entry->op){
+      case STRESS_CREATE: {
+        entry->file = thread->next_file++;
+        entry->dir = stress_random(&thread->rng) % profile->fan_out;
+        thread->file_dir[entry->file] = entry->dir;
+        thread->live[thread->live_count++] = entry->file;
+        stress_path(profile, thread->index, entry->dir, entry->file, path, sizeof(path));
+        stress_mark(thread, entry->file);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if(fd >= 0) close(fd);
+      } break;
+      case STRESS_MODIFY: {
+        entry->file = thread->live[pick];
+        entry->dir = thread->file_dir[entry->file];
+        stress_path(profile, thread->index, entry->dir, entry->file, path, sizeof(path));
+        stress_mark(thread, entry->file);
+        int fd = open(path, O_WRONLY | O_APPEND);
+        if(fd >= 0){
+          if(write(fd, "x", 1) != 1) perror("write");
+          close(fd);
+        }
+      } break;
+      case STRESS_DELETE: {
+        entry->file = thread->live[pick];
+        entry->dir = thread->file_dir[entry->file];
+        thread->live[pick] = thread->live[--thread->live_count];
+        stress_path(profile, thread->index, entry->dir, entry->file, path, sizeof(path));
+        stress_mark(thread, entry->file);
+        unlink(path);
+      } break;
+      case STRESS_RENAME: {
+        entry->file = thread->live[pick];
+        entry->dir = thread->file_dir[entry->file];
+        entry->new_file = thread->next_file++;
+        entry->new_dir = stress_random(&thread->rng) % profile->fan_out;
+        thread->file_dir[entry->new_file] = entry->new_dir;
+        thread->live[pick] = entry->new_file;
+        stress_path(profile, thread->index, entry->dir, entry->file, path, sizeof(path));
+        stress_path(profile, thread->index, entry->new_dir, entry->new_file, new_path, sizeof(new_path));
+        stress_mark(thread, entry->new_file);
+        rename(path, new_path);
+      } break;
+      default: break;
+    }
+  }
+  return NULL;
+}
+
+static void* stress_consume(void* arg){
+  const Stress_Profile* profile = arg;
+  FW* fw = &stress_fw;
+  FW_Options options = {.flags = FW_RECURSIVE};
+  if(!fw_init_ex(fw, profile->root, FW_ALL, &options)){
+    printf("init failed %s\n", fw_strerror(fw_error(fw)));
+    exit(1);
+  }
+  atomic_store(&stress_ready, true);
+
+  uint64_t cpu = stress_now(CLOCK_THREAD_CPUTIME_ID);
+  while(true){
+    if(!fw_watch(fw)){
+      printf("watch failed %s\n", fw_strerror(fw_error(fw)));
+      break;
+    }
+    atomic_store(&stress_cpu, stress_now(CLOCK_THREAD_CPUTIME_ID) - cpu);
+
+    if(strcmp(fw_name(fw), "stop") == 0) break;
+
+    Stress_Op op = STRESS_OP_COUNT;
+    const char* name = fw_name(fw);
+    switch(fw_event(fw)){
+      case FW_CREATE: op = STRESS_CREATE; break;
+      case FW_MODIFY: op = STRESS_MODIFY; break;
+      case FW_DELETE: op = STRESS_DELETE; break;
+      case FW_RENAME: op = STRESS_RENAME; name = fw_new_name(fw); break;
+      default: break;
+    }
+    if(op == STRESS_OP_COUNT) continue;
+    if(fw_error(fw) == FW_E_INCOMPLETE_EVENT){
+      atomic_fetch_add(&stress_incomplete, 1);
+    }
+
+    int thread = 0;
+    long file = 0;
+    // directories are created before the watch, only files are counted
+    if(sscanf(name, "t%d_%ld", &thread, &file) != 2) continue;
+    if(thread < 0 || thread >= profile->threads || file < 0 || file >= profile->ops) continue;
+
+    atomic_fetch_add(&stress_received[op], 1);
+    uint64_t sent = atomic_load_explicit(&stress_sent[(long)thread*profile->ops + file], memory_order_relaxed);
+    long i = atomic_fetch_add(&stress_latency_count, 1);
+    if(i < (long)profile->threads*profile->ops){
+      stress_latency[i] = stress_now(CLOCK_MONOTONIC) - sent;
+    }
+  }
+  fw_deinit(fw);
+  atomic_store(&stress_done, true);
+  return NULL;
+}
+
+static bool stress_write_log(const Stress_Profile* profile, Stress_Thread* threads){
+  FILE* log = fopen(profile->log, "w");
+  if(log == NULL){
+    perror(profile->log);
+    return false;
+  }
+  char path[FW_PATH_MAX];
+  char new_path[FW_PATH_MAX];
+  for(int t = 0; t < profile->threads; ++t){
+    for(long i = 0; i < threads[t].entry_count; ++i){
+      Stress_Entry* entry = &threads[t].entries[i];
+      stress_path(profile, t, entry->dir, entry->file, path, sizeof(path));
+      if(entry->op == STRESS_RENAME){
+        stress_path(profile, t, entry->new_dir, entry->new_file, new_path, sizeof(new_path));
+        fprintf(log, "%d %ld %s %s %s\n", t, i, stress_op_names[entry->op], path, new_path);
+      }else{
+        fprintf(log, "%d %ld %s %s\n", t, i, stress_op_names[entry->op], path);
+      }
+    }
+  }
+  fclose(log);
+  return true;
+}
+
+static int stress_compare(const void* a, const void* b){
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void stress_usage(const char* program){
+  printf("usage: %s [options]\n", program);
+  printf("  -s <seed>        seed of the generated activity (default 1)\n");
+  printf("  -n <ops>         operations per thread (default 100000)\n");
+  printf("  -t <threads>     producer threads (default 4)\n");
+  printf("  -f <fan-out>     directories per thread (default 16)\n");
+  printf("  -r <rate>        total operations per second, 0 is unlimited (default 0)\n");
+  printf("  -m <c,m,d,r>     create/modify/delete/rename weights (default 40,30,15,15)\n");
+  printf("  -d <dir>         directory to generate activity in (default /dev/shm/fw_stress)\n");
+  printf("  -l <file>        write the expected event log to file\n");
+}
+
+int main(int argc, char** argv){
+  const char* program = *argv;
+  argv++;
+  argc--;
+
+  Stress_Profile profile = {
+    .seed = 1,
+    .ops = 100000,
+    .threads = 4,
+    .fan_out = 16,
+    .rate = 0,
+    .mix = {40, 30, 15, 15},
+    .root = "/dev/shm/fw_stress",
+  };
+
+  while(argc >= 2){
+    const char* flag = argv[0];
+    const char* value = argv[1];
+    if(strcmp(flag, "-s") == 0) profile.seed = strtoull(value, NULL, 10);
+    else if(strcmp(flag, "-n") == 0) profile.ops = atol(value);
+    else if(strcmp(flag, "-t") == 0) profile.threads = atoi(value);
+    else if(strcmp(flag, "-f") == 0) profile.fan_out = atoi(value);
+    else if(strcmp(flag, "-r") == 0) profile.rate = atol(value);
+    else if(strcmp(flag, "-d") == 0) profile.root = value;
+    else if(strcmp(flag, "-l") == 0) profile.log = value;
+    else if(strcmp(flag, "-m") == 0){
+      if(sscanf(value, "%d,%d,%d,%d", &profile.mix[0], &profile.mix[1], &profile.mix[2], &profile.mix[3]) != 4){
+        stress_usage(program);
+        return 1;
+      }
+    }else{
+      stress_usage(program);
+      return 1;
+    }
+    argv += 2;
+    argc -= 2;
+  }
+  int mix_total = profile.mix[0] + profile.mix[1] + profile.mix[2] + profile.mix[3];
+  if(argc != 0 || profile.ops <= 0 || profile.threads <= 0 || profile.fan_out <= 0 || mix_total <= 0){
+    stress_usage(program);
+    return 1;
+  }
+
+  char path[FW_PATH_MAX];
+  snprintf(path, sizeof(path), "rm -rf '%s'", profile.root);
+  if(system(path) != 0) return 1;
+  if(mkdir(profile.root, 0755) < 0){
+    perror(profile.root);
+    return 1;
+  }
+
+  Stress_Thread* threads = calloc(profile.threads, sizeof(*threads));
+  for(int t = 0; t < profile.threads; ++t){
+    threads[t].profile = &profile;
+    threads[t].index = t;
+    threads[t].rng = profile.seed*1000003u + t;
+    // every op creates at most one new file id
+    threads[t].live = calloc(profile.ops, sizeof(long));
+    threads[t].file_dir = calloc(profile.ops, sizeof(int));
+    threads[t].entries = calloc(profile.ops, sizeof(Stress_Entry));
+    snprintf(path, sizeof(path), "%s/t%d", profile.root, t);
+    mkdir(path, 0755);
+    for(int d = 0; d < profile.fan_out; ++d){
+      stress_path(&profile, t, d, -1, path, sizeof(path));
+      mkdir(path, 0755);
+    }
+  }
+  stress_sent = calloc((size_t)profile.threads*profile.ops, sizeof(*stress_sent));
+  // an op yields at most one event
+  stress_latency = calloc((size_t)profile.threads*profile.ops, sizeof(*stress_latency));
+
+  pthread_t consumer;
+  pthread_create(&consumer, NULL, stress_consume, &profile);
+  while(!atomic_load(&stress_ready)) sched_yield();
+
+  uint64_t start = stress_now(CLOCK_MONOTONIC);
+  pthread_t* producers = calloc(profile.threads, sizeof(*producers));
+  for(int t = 0; t < profile.threads; ++t){
+    pthread_create(&producers[t], NULL, stress_produce, &threads[t]);
+  }
+  for(int t = 0; t < profile.threads; ++t){
+    pthread_join(producers[t], NULL);
+  }
+  uint64_t produced = stress_now(CLOCK_MONOTONIC);
+
+  // lost events would make waiting for the consumer hang, give it a deadline
+  snprintf(path, sizeof(path), "%s/stop", profile.root);
+  close(open(path, O_CREAT | O_WRONLY, 0644));
+  while(!atomic_load(&stress_done) && stress_now(CLOCK_MONOTONIC) - produced < 5000000000ull){
+    usleep(1000);
+  }
+  uint64_t elapsed = stress_now(CLOCK_MONOTONIC) - start;
+
+  long expected[STRESS_OP_COUNT] = {0};
+  long expected_total = 0;
+  long received_total = 0;
+  for(int t = 0; t < profile.threads; ++t){
+    for(long i = 0; i < threads[t].entry_count; ++i){
+      expected[threads[t].entries[i].op]++;
+      expected_total++;
+    }
+  }
+
+  printf("seed %llu, %d threads x %ld ops, fan-out %d, mix %d/%d/%d/%d\n",
+      (unsigned long long)profile.seed, profile.threads, profile.ops, profile.fan_out,
+      profile.mix[0], profile.mix[1], profile.mix[2], profile.mix[3]);
+  printf("%-8s %10s %10s %8s\n", "event", "expected", "received", "loss");
+  for(int i = 0; i < STRESS_OP_COUNT; ++i){
+    long received = atomic_load(&stress_received[i]);
+    received_total += received;
+    printf("%-8s %10ld %10ld %7.2f%%\n", stress_op_names[i], expected[i], received,
+        expected[i] > 0 ? 100.0*(expected[i]-received)/expected[i] : 0.0);
+  }
+  printf("%-8s %10ld %10ld %7.2f%%\n", "total", expected_total, received_total,
+      100.0*(expected_total-received_total)/expected_total);
+  FW_Stats stats = fw_stats(&stress_fw);
+  printf("incomplete renames: %ld\n", atomic_load(&stress_incomplete));
+  printf("kernel queue overflows: %llu\n", (unsigned long long)stats.overflows);
+  printf("reads per event: %.3f\n", stats.events_parsed > 0 ? (double)stats.reads/stats.events_parsed : 0.0);
+  printf("produced: %.0f ops/s\n", expected_total/((produced-start)/1e9));
+
+  long latency_count = atomic_load(&stress_latency_count);
+  if(latency_count > (long)profile.threads*profile.ops) latency_count = (long)profile.threads*profile.ops;
+  if(latency_count > 0){
+    qsort(stress_latency, latency_count, sizeof(*stress_latency), stress_compare);
+    printf("latency: p50 %.1fus p99 %.1fus p999 %.1fus\n",
+        stress_latency[(long)(0.5*(latency_count-1))]/1000.0,
+        stress_latency[(long)(0.99*(latency_count-1))]/1000.0,
+        stress_latency[(long)(0.999*(latency_count-1))]/1000.0);
+  }
+  uint64_t cpu = atomic_load(&stress_cpu);
+  printf("consumer cpu: %.1f%% (%.2fus per event)\n",
+      100.0*cpu/elapsed,
+      received_total > 0 ? cpu/1000.0/received_total : 0.0);
+
+  if(profile.log != NULL && !stress_write_log(&profile, threads)) return 1;
+
+  snprintf(path, sizeof(path), "rm -rf '%s'", profile.root);
+  if(system(path) != 0) return 1;
+  return 0;
+}
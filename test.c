@@ -0,0 +1,384 @@
+#define FW_IMPLEMENTATION
+#include "fw.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// small regression checks against a scratch directory, ./nob test && ./test
+
+static char root[256];
+static char events[1 << 16];
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+      printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  }while(0)
+
+// runs a shell command, %1$s in it is the scratch directory
+static void run(const char* format){
+  char cmd[1024];
+  snprintf(cmd, sizeof(cmd), format, root);
+  if(system(cmd) != 0) printf("  failed: %s\n", cmd);
+}
+
+// collects the events that arrive within a short while as "event path"
+// lines, which the checks search with contains()
+static void drain(FW* fw){
+  size_t len = 0;
+  events[0] = '\0';
+  uint64_t deadline = fw__now() + 100000000ull;
+  while(fw__now() < deadline){
+    if(!fw_read(fw)){
+      if(fw_error(fw) != FW_E_NO_EVENT) break;
+      struct timespec ts = {0, 2000000};
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    FW_Record record;
+    while(fw_next(fw, &record)){
+      char path[FW_PATH_MAX];
+      char new_path[FW_PATH_MAX];
+      fw_record_path(fw, &record, path, sizeof(path));
+      fw_record_new_path(fw, &record, new_path, sizeof(new_path));
+      len += snprintf(events + len, sizeof(events) - len, "%d %s %s\n", record.event, path, new_path);
+      if(len >= sizeof(events)) len = sizeof(events) - 1;
+    }
+  }
+}
+
+static bool contains(const char* format){
+  char needle[512];
+  snprintf(needle, sizeof(needle), format, root);
+  return strstr(events, needle) != NULL;
+}
+
+// a directory moved out of the tree must take its watches along, moved
+// back in it is walked again
+static void test_move_out(void){
+  run("rm -rf %1$s && mkdir -p %1$s/w/a/b %1$s/outside");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/w", root);
+  CHECK(fw_init_ex(&fw, path, FW_ALL, &options));
+  CHECK(fw_coverage(&fw).directories == 3);
+
+  run("mv %1$s/w/a %1$s/outside/a");
+  drain(&fw);
+  CHECK(fw_coverage(&fw).directories == 1);
+  run("touch %1$s/outside/a/b/leak");
+  drain(&fw);
+  CHECK(!contains("leak"));
+
+  run("mkdir -p %1$s/w/a/b");
+  drain(&fw);
+  run("mv %1$s/w/a %1$s/w/z && touch %1$s/w/z/b/f2");
+  drain(&fw);
+  CHECK(contains("%1$s/w/z/b/f2"));
+  CHECK(!contains("%1$s/w/a/b/f2"));
+
+  run("mv %1$s/outside/a %1$s/w/back");
+  drain(&fw);
+  run("touch %1$s/w/back/b/f3");
+  drain(&fw);
+  CHECK(contains("%1$s/w/back/b/f3"));
+  CHECK(fw_coverage(&fw).directories == 5);
+  fw_deinit(&fw);
+}
+
+// widening the events of an armed path keeps its context and its queue
+static void test_wait_widen(void){
+  run("rm -rf %1$s && mkdir -p %1$s/a %1$s/b");
+  char a[512];
+  char b[512];
+  snprintf(a, sizeof(a), "%s/a", root);
+  snprintf(b, sizeof(b), "%s/b", root);
+  FW_WaitPool pool;
+  CHECK(fw_wait_pool_init(&pool, 2));
+  CHECK(fw_wait_for(&pool, b, FW_CREATE, NULL, NULL, 0) == NULL);
+  FW* first = fw_wait_for(&pool, a, FW_CREATE, NULL, NULL, 0);
+  CHECK(first == NULL && pool.error == FW_E_NO_EVENT);
+
+  run("touch %1$s/a/x");
+  first = fw_wait_for(&pool, a, FW_CREATE, NULL, NULL, 1000);
+  CHECK(first != NULL);
+  // queued while only FW_CREATE is armed and delivered after widening
+  run("touch %1$s/a/y");
+  FW* widened = fw_wait_for(&pool, a, FW_CREATE | FW_MODIFY, NULL, NULL, 1000);
+  CHECK(widened == first);
+  CHECK(widened != NULL && strcmp(fw_name(widened), "y") == 0);
+  run("echo 1 > %1$s/a/x");
+  widened = fw_wait_for(&pool, a, FW_MODIFY, NULL, NULL, 1000);
+  CHECK(widened == first);
+  CHECK(widened != NULL && fw_event(widened) == FW_MODIFY);
+  fw_wait_pool_deinit(&pool);
+}
+
+// a sibling sharing the root as a prefix is not part of the tree
+static void test_ready_prefix(void){
+  run("rm -rf %1$s && mkdir -p %1$s/a/b %1$s/ab/b");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/a", root);
+  CHECK(fw_init_ex(&fw, path, FW_ALL, &options));
+  snprintf(path, sizeof(path), "%s/a/b", root);
+  CHECK(fw_ready(&fw, path));
+  CHECK(fw_ready(&fw, "b"));
+  snprintf(path, sizeof(path), "%s/ab", root);
+  CHECK(!fw_ready(&fw, path));
+  fw_deinit(&fw);
+}
+
+// events held back in the bulk lane keep the time they were read at
+static void test_priority_times(void){
+  run("rm -rf %1$s && mkdir -p %1$s/bulk %1$s/hot");
+  FW fw;
+  const char* priority[] = {"hot"};
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK;
+  options.priority = priority;
+  options.priority_count = 1;
+  CHECK(fw_init_ex(&fw, root, FW_CREATE, &options));
+  run("cd %1$s/bulk && for i in $(seq 2000); do : > f$i; done && : > %1$s/hot/now");
+  struct timespec ts = {0, 50000000};
+  nanosleep(&ts, NULL);
+
+  int bulk = 0;
+  int bulk_after = 0;
+  uint64_t hot_time = 0;
+  uint64_t bulk_max = 0;
+  FW_Record record;
+  while(fw_read(&fw)){
+    while(fw_next(&fw, &record)){
+      if(strcmp(record.name, "now") == 0){
+        hot_time = record.time;
+        continue;
+      }
+      bulk++;
+      if(hot_time != 0) bulk_after++;
+      if(record.time > bulk_max) bulk_max = record.time;
+    }
+  }
+  CHECK(bulk == 2000);
+  CHECK(hot_time != 0 && bulk_after > 0);
+  CHECK(bulk_max <= hot_time);
+  fw_deinit(&fw);
+}
+
+static bool only_c(const char* name, size_t len, void* data){
+  (void)data;
+  return len >= 2 && strcmp(name + len - 2, ".c") == 0;
+}
+
+// names rejected by the filter are never delivered nor counted as such
+static void test_filter(void){
+  run("rm -rf %1$s && mkdir -p %1$s");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_NONBLOCK;
+  options.filter = only_c;
+  CHECK(fw_init_ex(&fw, root, FW_ALL, &options));
+  run("touch %1$s/a.c %1$s/a.h && mv %1$s/a.h %1$s/b.c");
+  drain(&fw);
+  CHECK(contains("1 %1$s/a.c "));
+  CHECK(!contains("1 %1$s/a.h "));
+  CHECK(contains("8 %1$s/a.h %1$s/b.c"));
+  FW_Stats stats = fw_stats(&fw);
+  CHECK(stats.events_delivered == 2);
+  CHECK(stats.events_filtered == 1);
+  fw_deinit(&fw);
+}
+
+// bits of watches the caller adds to fw_fd are not mistaken for fw's own
+static void test_mask_add(void){
+  run("rm -rf %1$s && mkdir -p %1$s/d && touch %1$s/d/f");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_NONBLOCK | FW_RECURSIVE | FW_MASK_ADD;
+  CHECK(fw_init_ex(&fw, root, FW_ALL | FW_DELETE_TREE | FW_ROOT_BACK, &options));
+  char path[512];
+  snprintf(path, sizeof(path), "%s/d", root);
+  CHECK(inotify_add_watch(fw_fd(&fw), root, IN_ACCESS | IN_OPEN | IN_CLOSE_NOWRITE | IN_MASK_ADD) >= 0);
+  CHECK(inotify_add_watch(fw_fd(&fw), path, IN_ACCESS | IN_OPEN | IN_CLOSE_NOWRITE | IN_MASK_ADD) >= 0);
+  run("ls %1$s %1$s/d > /dev/null && cat %1$s/d/f && rm %1$s/d/f");
+  drain(&fw);
+  CHECK(!contains("64 %1$s"));
+  CHECK(contains("2 %1$s/d/f "));
+  fw_deinit(&fw);
+}
+
+// a lost root is watched again once it is back, even when its parent
+// was gone as well, and it is dropped again when moved away
+static void test_root_rearm(void){
+  run("rm -rf %1$s && mkdir -p %1$s/p/root/a/b");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK | FW_REARM;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/p/root", root);
+  CHECK(fw_init_ex(&fw, path, FW_ALL | FW_ROOT_LOST | FW_ROOT_BACK, &options));
+
+  run("rm -rf %1$s/p/root");
+  drain(&fw);
+  CHECK(contains("32 %1$s/p/root "));
+  run("mkdir -p %1$s/p/root/x");
+  drain(&fw);
+  CHECK(contains("64 %1$s/p/root "));
+  run("touch %1$s/p/root/x/f");
+  drain(&fw);
+  CHECK(contains("1 %1$s/p/root/x/f "));
+
+  run("rm -rf %1$s/p");
+  drain(&fw);
+  CHECK(contains("32 %1$s/p/root "));
+  run("mkdir %1$s/p");
+  drain(&fw);
+  CHECK(events[0] == '\0');
+  run("mkdir %1$s/p/root");
+  drain(&fw);
+  CHECK(contains("64 %1$s/p/root "));
+
+  run("mv %1$s/p/root %1$s/p/away");
+  drain(&fw);
+  CHECK(contains("32 %1$s/p/root "));
+  run("touch %1$s/p/away/nope");
+  drain(&fw);
+  CHECK(!contains("nope"));
+  run("mv %1$s/p/away %1$s/p/root");
+  drain(&fw);
+  CHECK(contains("64 %1$s/p/root "));
+  run("touch %1$s/p/root/yes");
+  drain(&fw);
+  CHECK(contains("1 %1$s/p/root/yes "));
+  CHECK(fw_coverage(&fw).directories == 1);
+  fw_deinit(&fw);
+}
+
+// without FW_REARM a lost root ends the watch instead of blocking forever
+static void test_root_lost(void){
+  run("rm -rf %1$s && mkdir -p %1$s/root/a");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/root", root);
+  CHECK(fw_init_ex(&fw, path, FW_ALL | FW_ROOT_LOST, &options));
+  run("rm -rf %1$s/root");
+  drain(&fw);
+  CHECK(contains("2 %1$s/root/a "));
+  CHECK(contains("32 %1$s/root "));
+  CHECK(!fw_read(&fw) && fw_error(&fw) == FW_E_PATH_NOT_FOUND);
+  fw_deinit(&fw);
+}
+
+// a watched file follows replacements and comes back with its directory
+static void test_file_rearm(void){
+  run("rm -rf %1$s && mkdir -p %1$s/d && echo a > %1$s/d/f.conf");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_NONBLOCK | FW_REARM;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/d/f.conf", root);
+  CHECK(fw_init_ex(&fw, path, FW_ALL | FW_ROOT_LOST | FW_ROOT_BACK, &options));
+
+  run("echo b > %1$s/d/tmp && mv %1$s/d/tmp %1$s/d/f.conf && touch %1$s/d/other");
+  drain(&fw);
+  CHECK(contains("4 %1$s/d/f.conf "));
+  CHECK(!contains("other"));
+  run("echo c >> %1$s/d/f.conf");
+  drain(&fw);
+  CHECK(contains("4 %1$s/d/f.conf "));
+
+  run("rm -rf %1$s/d");
+  drain(&fw);
+  CHECK(contains("2 %1$s/d/f.conf "));
+  CHECK(contains("32 %1$s/d/f.conf "));
+  run("mkdir %1$s/d");
+  drain(&fw);
+  CHECK(contains("64 %1$s/d/f.conf "));
+  run("echo d > %1$s/d/f.conf");
+  drain(&fw);
+  CHECK(contains("1 %1$s/d/f.conf "));
+  run("echo e >> %1$s/d/f.conf");
+  drain(&fw);
+  CHECK(contains("4 %1$s/d/f.conf "));
+  fw_deinit(&fw);
+}
+
+// rm -rf of a tree larger than the held deletions may take is one event,
+// long names keep the number of files down
+static void test_tree_delete(void){
+  run("rm -rf %1$s && mkdir -p %1$s/w/t && cd %1$s/w/t"
+    " && for d in $(seq 25); do mkdir d$d && (cd d$d && seq -f %%0200g 1000 | xargs touch); done");
+  FW fw;
+  FW_Options options = {0};
+  options.flags = FW_RECURSIVE | FW_NONBLOCK;
+  char path[512];
+  snprintf(path, sizeof(path), "%s/w", root);
+  CHECK(fw_init_ex(&fw, path, FW_DELETE | FW_DELETE_TREE | FW_CREATE, &options));
+  CHECK(fw_coverage(&fw).directories == 27);
+
+  // read while it runs, the kernel queue is shorter than the tree
+  run("(rm -rf %1$s/w/t && touch %1$s/w/done) &");
+  int deletes = 0;
+  int trees = 0;
+  bool done = false;
+  uint64_t deadline = fw__now() + 60000000000ull;
+  while(!done && fw__now() < deadline){
+    if(!fw_read(&fw)){
+      if(fw_error(&fw) != FW_E_NO_EVENT) break;
+      struct timespec ts = {0, 1000000};
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    FW_Record record;
+    while(fw_next(&fw, &record)){
+      if(record.event == FW_DELETE) deletes++;
+      if(record.event == FW_DELETE_TREE && strcmp(record.name, "t") == 0) trees++;
+      if(record.event == FW_CREATE && strcmp(record.name, "done") == 0) done = true;
+    }
+  }
+  CHECK(done);
+  CHECK(trees == 1);
+  CHECK(deletes == 0);
+  CHECK(fw_coverage(&fw).directories == 1);
+  CHECK(fw_stats(&fw).overflows == 0);
+  fw_deinit(&fw);
+}
+
+typedef struct{
+  const char* name;
+  void (*run)(void);
+} Test;
+
+static const Test tests[] = {
+  {"move_out", test_move_out},
+  {"wait_widen", test_wait_widen},
+  {"ready_prefix", test_ready_prefix},
+  {"priority_times", test_priority_times},
+  {"filter", test_filter},
+  {"mask_add", test_mask_add},
+  {"root_rearm", test_root_rearm},
+  {"root_lost", test_root_lost},
+  {"file_rearm", test_file_rearm},
+  {"tree_delete", test_tree_delete},
+};
+
+int main(int argc, char** argv){
+  const char* dir = argc > 1 ? argv[1] : "/tmp";
+  snprintf(root, sizeof(root), "%s/fw_test_%d", dir, (int)getpid());
+
+  for(size_t i = 0; i < sizeof(tests)/sizeof(*tests); ++i){
+    int before = failures;
+    tests[i].run();
+    printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+  }
+  run("rm -rf %1$s");
+  return failures == 0 ? 0 : 1;
+}